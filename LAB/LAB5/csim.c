@@ -1,94 +1,1465 @@
 /* 20190650 Gwanho Kim */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "cachelab.h"
 
-struct Block {
-    bool is_valid;
-    unsigned int tag;
-    unsigned int placed_time;
+#define MAX_LEVELS 8
+#define BATCH_SIZE 4096
+#define QUEUE_DEPTH 8 // batches queued for a worker before the reader waits
+#define SET_GROUP 16  // consecutive sets owned by the same worker
+#define SWEEP_MAX_S 20 // most set index bits in a sweep
+#define SWEEP_MAX_E 1024
+#define INVALID_TAG (~0UL) // the tag of an empty line, above any real tag
+#define MAX_REGIONS 64
+
+struct Cache;
+struct Shadow;
+struct Report;
+
+// A replacement policy: hit and fill update the state of a line of a set,
+// and victim picks the line of a full set to evict
+struct Policy {
+    const char *name;
+    void (*hit)(struct Cache *c, unsigned int set_index, int way);
+    void (*fill)(struct Cache *c, unsigned int set_index, int way);
+    int (*victim)(struct Cache *c, unsigned int set_index);
 };
 
-unsigned int s, E, b, hit_count, miss_count, eviction_count, time_count;
-struct Block **cache;
-void operate(unsigned int address);
-bool find(unsigned int set_index, unsigned int tag);
-bool is_full(unsigned int set_index);
-void evict(unsigned int set_index, unsigned int tag);
-void place(unsigned int set_index, unsigned int tag);
-
-void operate(unsigned int address) {
-    unsigned int tag = address >> (s + b);
-    unsigned int set_index = (address >> b) & ((1 << s) - 1);
-    if (find(set_index, tag)) {
-        hit_count++;
-    } else {
-        miss_count++;
-        if (is_full(set_index)) {
-            eviction_count++;
-            evict(set_index, tag);
-        } else {
-            place(set_index, tag);
+// How a lower level relates to the levels above it: it holds everything they
+// hold (inclusive), nothing they hold (exclusive), or either (nine)
+enum Relation { NINE, INCLUSIVE, EXCLUSIVE };
+
+// One level of the hierarchy
+struct Cache {
+    const char *name;
+    unsigned int s, E, b;
+    const struct Policy *policy;
+    enum Relation relation;
+    // 2^s sets of E blocks, stored as flat arrays so that the ways of a set
+    // can be compared at once: the tags (INVALID_TAG for an empty line), and
+    // the policy state, a time or count in stamp, and a bit, a tree node or a
+    // re-reference prediction value in state; dirty marks the lines written
+    // since they were filled, under write-back
+    unsigned long *tags;
+    unsigned int *stamp;
+    unsigned char *state;
+    unsigned char *dirty;
+    unsigned int hit_count, miss_count, eviction_count, invalidation_count;
+    // Evictions of dirty lines, and the bytes written to the level below (or
+    // memory): written back lines, and stores passed on
+    unsigned int dirty_eviction_count;
+    unsigned long write_bytes;
+    // The line the last lookup found or the last fill placed, or -1, so that
+    // a store need not search its set again
+    long line;
+    // With -c, the misses sorted into compulsory, capacity and conflict
+    struct Shadow *shadow;
+    // With -r or -H, where the misses and evictions of the L1 fall
+    struct Report *report;
+    // Time of the current record, and the state of the random numbers of
+    // each set, so that a set draws the same numbers however the sets are
+    // shared among the workers of -j
+    unsigned int time;
+    unsigned int *random_state;
+};
+
+// One decoded trace record
+struct Access {
+    char operation;
+    unsigned int size;
+    unsigned long address;
+};
+
+// A trace file mapped (or read) into memory, and how far it has been scanned
+struct Trace {
+    const char *data, *next, *end;
+    bool mapped;
+};
+
+// One reference queued for a worker: an address, the time of its record,
+// whether it is a store, and the bytes it stores
+struct Ref {
+    unsigned long address;
+    unsigned int time;
+    bool write;
+    unsigned int size;
+};
+
+// A thread simulating the groups of sets it owns, fed batches of references
+// through a ring of QUEUE_DEPTH buffers by the thread reading the trace
+struct Worker {
+    pthread_t thread;
+    struct Cache cache; // shares the sets, but has its own counts
+    struct Ref *buffers[QUEUE_DEPTH];
+    int lengths[QUEUE_DEPTH];
+    int head, tail, count, filling;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// The LRU stack of every set for one set index function (2^s sets) in a
+// sweep: a treap per set of the lines it holds, keyed by the time of their
+// last access, and the distances found. Node i is the i-th line seen.
+struct Sweep {
+    unsigned int s;
+    int *roots;
+    unsigned int *key;
+    int *left, *right, *size;
+    unsigned long *near;    // accesses at each distance below the largest E
+    unsigned long far;      // accesses at larger distances
+    unsigned long cold;     // first accesses to a line
+    unsigned long log[65];  // accesses at distances in [2^(i-1), 2^i)
+};
+
+// Lines seen in a sweep or by a shadow cache: an open-addressing table from
+// the line address to its node number, and the time of each line's last
+// access in a sweep
+struct Lines {
+    unsigned long *address;
+    int *node;
+    unsigned int *last;
+    size_t capacity, count;
+};
+
+// A fully associative LRU cache of as many lines as a cache, which sorts
+// that cache's misses into the 3 Cs: the lines seen so far, whose first
+// access is a compulsory miss, and an LRU list threaded through their node
+// numbers of the lines the shadow holds. A miss the shadow also has is a
+// capacity miss, and any other a conflict miss.
+struct Shadow {
+    struct Lines lines;
+    int *prev, *next;    // towards the most and the least recently used
+    unsigned char *held; // whether each line is in the list
+    size_t nodes;        // size of the node arrays
+    int head, tail;      // the most and the least recently used line
+    size_t capacity, count;
+    unsigned int compulsory_count, capacity_count, conflict_count;
+};
+
+// A named range [start, end) of addresses from a region map, and the
+// accesses, misses and evictions of the lines in it
+struct Region {
+    char name[32];
+    unsigned long start, end;
+    unsigned long access_count, miss_count, eviction_count;
+};
+
+// The misses, conflict misses and evictions of each line of a cache, by
+// node number in a table of the lines seen, the misses and evictions of each
+// set, and those of each region of a map; regions[num_regions] holds the
+// rest of the addresses
+struct Report {
+    struct Lines lines;
+    unsigned int *misses, *conflicts, *evictions;
+    size_t nodes;
+    unsigned long *set_misses, *set_evictions;
+    struct Region regions[MAX_REGIONS + 1];
+    int num_regions;
+};
+
+// A line or a set ranked in a report
+struct Hot {
+    unsigned long address;
+    unsigned long count;
+    int node;
+};
+
+unsigned int time_count;
+bool use_avx2;
+// The write policy of every level: whether a store hit stays in the line
+// until it is evicted (write-back) or goes on below at once (write-through),
+// and whether a store miss fills the line (write-allocate) or not
+bool write_back = true;
+bool write_allocate = true;
+// Whether an access counts once for every line its bytes touch (-a), rather
+// than once for the line of its address, as csim-ref counts
+bool split_accesses;
+// Digit value of each character, or 0xff if it is not a hex digit
+unsigned char hex_value[256];
+// levels[0] is the L1 data (or unified) cache, and levels[1..] the levels
+// below it; l1i is the L1 instruction cache, if the L1 is split
+struct Cache *levels[MAX_LEVELS];
+int num_levels;
+struct Cache *l1i;
+struct Cache *new_cache(const char *name, unsigned int s, unsigned int E,
+                        unsigned int b, const char *policy_name);
+struct Cache *parse_level(const char *name, char *spec);
+void operate(struct Cache *l1, unsigned long address, bool write,
+             unsigned int size);
+bool lookup(struct Cache *c, unsigned long address);
+long line_of(struct Cache *c, unsigned long address);
+void store(struct Cache *c, unsigned long address, unsigned int size);
+void write_in(int level, unsigned long address, unsigned long size);
+int find_way(const unsigned long *tags, unsigned int E, unsigned long tag);
+int find_min(const unsigned int *stamps, unsigned int E);
+void insert(int level, struct Cache *c, unsigned long address, bool dirty);
+bool fill(struct Cache *c, unsigned long address, bool dirty,
+          unsigned long *victim, bool *victim_dirty);
+int invalidate(struct Cache *c, unsigned long address, unsigned long size,
+               bool *dirty);
+void print_level(struct Cache *c);
+unsigned int next_random(struct Cache *c, unsigned int set_index);
+bool open_trace(struct Trace *t, const char *path);
+int read_batch(struct Trace *t, struct Access *batch, int max);
+void close_trace(struct Trace *t);
+unsigned long span(const struct Access *a, unsigned int b);
+unsigned long piece(const struct Access *a, unsigned int b, unsigned long k,
+                    unsigned int *size);
+void simulate(struct Trace *t);
+void simulate_parallel(struct Trace *t, int num_threads);
+void *simulate_sets(void *arg);
+void push_ref(struct Worker *w, unsigned long address, unsigned int time,
+              bool write, unsigned int size);
+void publish(struct Worker *w);
+void sweep(struct Trace *t, unsigned int b, unsigned int max_s,
+           unsigned int max_e);
+int find_line(struct Lines *lines, unsigned long address);
+void split(struct Sweep *w, int root, unsigned int key, int *le, int *gt);
+int merge(struct Sweep *w, int l, int r);
+void resize(struct Sweep *w, int node);
+struct Shadow *new_shadow(size_t capacity);
+bool shadow_access(struct Shadow *h, unsigned long address, bool *first);
+void unlink_node(struct Shadow *h, int node);
+struct Report *new_report(struct Cache *c, const char *map_path);
+struct Region *find_region(struct Report *r, unsigned long address);
+int report_line(struct Report *r, unsigned long address);
+void print_report(struct Cache *c, int top);
+int compare_hot(const void *a, const void *b);
+
+// lru - Evict the line used longest ago
+void lru_touch(struct Cache *c, unsigned int set_index, int way) {
+    c->stamp[set_index * c->E + way] = c->time;
+}
+
+int lru_victim(struct Cache *c, unsigned int set_index) {
+    // Find the lru(Least Recently Used) block
+    return find_min(&c->stamp[set_index * c->E], c->E);
+}
+
+// fifo - Evict the line filled longest ago, whatever its hits: lru, but with
+// the time stamped at the fill only
+
+// no_update - Leave the state alone, for fifo hits and random
+void no_update(struct Cache *c, unsigned int set_index, int way) {}
+
+// random - Evict any line
+int random_victim(struct Cache *c, unsigned int set_index) {
+    return next_random(c, set_index) % c->E;
+}
+
+// lfu - Evict the line with the fewest hits since it was filled
+void lfu_hit(struct Cache *c, unsigned int set_index, int way) {
+    c->stamp[set_index * c->E + way]++;
+}
+
+void lfu_fill(struct Cache *c, unsigned int set_index, int way) {
+    c->stamp[set_index * c->E + way] = 0;
+}
+
+// tree - Tree pseudo-LRU: E-1 nodes of a binary tree over the lines, node i
+// with children 2i and 2i+1, each pointing to the half to evict from next
+void tree_touch(struct Cache *c, unsigned int set_index, int way) {
+    unsigned char *node = &c->state[set_index * c->E];
+    // walk from the root to the line, pointing each node to the other half
+    for (int i = 1, half = c->E / 2; half > 0; half /= 2) {
+        bool right = way & half;
+        node[i] = !right;
+        i = 2 * i + right;
+    }
+}
+
+int tree_victim(struct Cache *c, unsigned int set_index) {
+    unsigned char *node = &c->state[set_index * c->E];
+    int i = 1;
+    while (i < c->E) {
+        i = 2 * i + node[i];
+    }
+    return i - c->E;
+}
+
+// bit - Bit pseudo-LRU: a used bit per line, all but the last one cleared
+// when every bit is set; evict the first line not used
+void bit_touch(struct Cache *c, unsigned int set_index, int way) {
+    unsigned char *used = &c->state[set_index * c->E];
+    int unused = 0;
+    used[way] = 1;
+    for (int i = 0; i < c->E; i++) {
+        unused += !used[i];
+    }
+    if (unused == 0) {
+        memset(used, 0, c->E);
+        used[way] = 1;
+    }
+}
+
+int bit_victim(struct Cache *c, unsigned int set_index) {
+    unsigned char *used = &c->state[set_index * c->E];
+    for (int i = 0; i < c->E; i++) {
+        if (!used[i]) {
+            return i;
         }
     }
+    return 0;
 }
 
-bool find(unsigned int set_index, unsigned int tag) {
-    for (int i = 0; i < E; i++) {
-        // Find the block which is valid and has the same tag as the tag of the
-        // address
-        if (cache[set_index][i].is_valid && cache[set_index][i].tag == tag) {
-            cache[set_index][i].placed_time = time_count;
-            return true;
+// srrip, brrip - Static and bimodal re-reference interval prediction with
+// 2-bit values: a hit predicts a near re-reference (0), a fill a long one (2),
+// or for brrip a distant one (3) but for 1 in 32 fills, and the victim is the
+// first line predicted distant, after aging the set until there is one
+#define RRPV_MAX 3
+#define BRRIP_LONG 32
+
+void rrip_hit(struct Cache *c, unsigned int set_index, int way) {
+    c->state[set_index * c->E + way] = 0;
+}
+
+void srrip_fill(struct Cache *c, unsigned int set_index, int way) {
+    c->state[set_index * c->E + way] = RRPV_MAX - 1;
+}
+
+void brrip_fill(struct Cache *c, unsigned int set_index, int way) {
+    c->state[set_index * c->E + way] =
+        next_random(c, set_index) % BRRIP_LONG == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+int rrip_victim(struct Cache *c, unsigned int set_index) {
+    unsigned char *rrpv = &c->state[set_index * c->E];
+    for (;;) {
+        for (int i = 0; i < c->E; i++) {
+            if (rrpv[i] == RRPV_MAX) {
+                return i;
+            }
+        }
+        for (int i = 0; i < c->E; i++) {
+            rrpv[i]++;
+        }
+    }
+}
+
+const struct Policy policies[] = {
+    {"lru", lru_touch, lru_touch, lru_victim},
+    {"fifo", no_update, lru_touch, lru_victim},
+    {"random", no_update, no_update, random_victim},
+    {"tree", tree_touch, tree_touch, tree_victim},
+    {"bit", bit_touch, bit_touch, bit_victim},
+    {"lfu", lfu_hit, lfu_fill, lru_victim},
+    {"srrip", rrip_hit, srrip_fill, rrip_victim},
+    {"brrip", rrip_hit, brrip_fill, rrip_victim},
+};
+
+// Make an empty cache of 2^s sets of E lines of 2^b bytes
+struct Cache *new_cache(const char *name, unsigned int s, unsigned int E,
+                        unsigned int b, const char *policy_name) {
+    struct Cache *c = (struct Cache *)calloc(1, sizeof(struct Cache));
+    size_t lines = ((size_t)1 << s) * E;
+    c->name = name;
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policy_name, policies[i].name) == 0) {
+            c->policy = &policies[i];
         }
     }
+    if (c->policy == NULL) {
+        fprintf(stderr, "unknown policy %s: use lru, fifo, random, tree, "
+                        "bit, lfu, srrip or brrip\n",
+                policy_name);
+        exit(1);
+    }
+    // The tree needs a node for every pair of halves down to single lines
+    if (c->policy->victim == tree_victim && (E & (E - 1)) != 0) {
+        fprintf(stderr, "tree policy needs a power of two for E\n");
+        exit(1);
+    }
+    c->tags = (unsigned long *)malloc(lines * sizeof(unsigned long));
+    memset(c->tags, 0xff, lines * sizeof(unsigned long));
+    c->stamp = (unsigned int *)calloc(lines, sizeof(unsigned int));
+    c->state = (unsigned char *)calloc(lines, sizeof(unsigned char));
+    c->dirty = (unsigned char *)calloc(lines, sizeof(unsigned char));
+    c->random_state = (unsigned int *)malloc(sizeof(unsigned int) << s);
+    for (unsigned int i = 0; i < (1U << s); i++) {
+        c->random_state[i] = i + 1;
+    }
+    return c;
+}
+
+// Make a level from a spec like "8,8,6,srrip,inclusive": s, E and b, then
+// optionally the policy and the relation to the levels above
+struct Cache *parse_level(const char *name, char *spec) {
+    unsigned int s, E, b;
+    char *policy_name = "lru";
+    char *relation = "nine";
+    char *fields[5] = {NULL};
+    char *field = strtok(spec, ",");
+    for (int i = 0; i < 5 && field != NULL; i++, field = strtok(NULL, ",")) {
+        fields[i] = field;
+    }
+    if (fields[2] == NULL || sscanf(fields[0], "%u", &s) != 1 ||
+        sscanf(fields[1], "%u", &E) != 1 || sscanf(fields[2], "%u", &b) != 1) {
+        fprintf(stderr, "bad level %s: use s,E,b[,policy[,relation]]\n",
+                name);
+        exit(1);
+    }
+    if (fields[3] != NULL) {
+        policy_name = fields[3];
+    }
+    if (fields[4] != NULL) {
+        relation = fields[4];
+    }
+    struct Cache *c = new_cache(name, s, E, b, policy_name);
+    if (strcmp(relation, "inclusive") == 0) {
+        c->relation = INCLUSIVE;
+    } else if (strcmp(relation, "exclusive") == 0) {
+        c->relation = EXCLUSIVE;
+    } else if (strcmp(relation, "nine") != 0) {
+        fprintf(stderr, "unknown relation %s: use inclusive, exclusive or "
+                        "nine\n",
+                relation);
+        exit(1);
+    }
+    return c;
+}
+
+// Access address through the hierarchy, starting at the L1 cache l1: a load,
+// or a store (write) of size bytes
+void operate(struct Cache *l1, unsigned long address, bool write,
+             unsigned int size) {
+    int hit_level = num_levels;
+    bool dirty = false;
+    // The policies stamp lines with the time of this record
+    l1->time = time_count;
+    for (int i = 1; i < num_levels; i++) {
+        levels[i]->time = time_count;
+    }
+    // A store that does not allocate leaves the levels below to the write
+    if (write && !write_allocate) {
+        lookup(l1, address);
+        store(l1, address, size);
+        return;
+    }
+    // Go down until a level has the line, or else to memory
+    for (int i = 0; i < num_levels; i++) {
+        if (lookup(i == 0 ? l1 : levels[i], address)) {
+            hit_level = i;
+            break;
+        }
+    }
+    // An exclusive level gives its line up to the levels above
+    if (hit_level > 0 && hit_level < num_levels &&
+        levels[hit_level]->relation == EXCLUSIVE) {
+        invalidate(levels[hit_level], address, 1, &dirty);
+    }
+    // Fill the levels that missed, from the bottom up so that an inclusive
+    // level's victims leave the levels above before they are filled; a dirty
+    // line given up goes to the L1 still dirty
+    for (int i = hit_level - 1; i >= 0; i--) {
+        if (i == 0 || levels[i]->relation != EXCLUSIVE) {
+            insert(i, i == 0 ? l1 : levels[i], address, i == 0 && dirty);
+        }
+    }
+    if (write) {
+        store(l1, address, size);
+    }
+}
+
+bool lookup(struct Cache *c, unsigned long address) {
+    unsigned long tag = address >> (c->s + c->b);
+    unsigned int set_index = (address >> c->b) & ((1UL << c->s) - 1);
+    bool first = false, shadow_hit = false;
+    struct Region *region = NULL;
+    if (c->shadow != NULL) {
+        shadow_hit = shadow_access(c->shadow, address >> c->b, &first);
+    }
+    if (c->report != NULL) {
+        region = find_region(c->report, address);
+        region->access_count++;
+    }
+    // Find the block which has the same tag as the tag of the address
+    int way = find_way(&c->tags[set_index * c->E], c->E, tag);
+    if (way >= 0) {
+        c->hit_count++;
+        c->line = set_index * c->E + way;
+        c->policy->hit(c, set_index, way);
+        return true;
+    }
+    c->miss_count++;
+    c->line = -1;
+    if (c->shadow != NULL) {
+        if (first) {
+            c->shadow->compulsory_count++;
+        } else if (!shadow_hit) {
+            c->shadow->capacity_count++;
+        } else {
+            c->shadow->conflict_count++;
+        }
+    }
+    if (c->report != NULL) {
+        int node = report_line(c->report, address >> c->b);
+        c->report->misses[node]++;
+        c->report->conflicts[node] += c->shadow != NULL && !first && shadow_hit;
+        c->report->set_misses[set_index]++;
+        region->miss_count++;
+    }
     return false;
 }
 
-bool is_full(unsigned int set_index) {
+// Find the line of c holding address, as an index into its flat arrays, or -1
+long line_of(struct Cache *c, unsigned long address) {
+    unsigned long tag = address >> (c->s + c->b);
+    unsigned long set_index = (address >> c->b) & ((1UL << c->s) - 1);
+    int way = find_way(&c->tags[set_index * c->E], c->E, tag);
+    return way < 0 ? -1 : (long)(set_index * c->E + way);
+}
+
+// Write size bytes at address into c after its lookup, and its fill if it
+// missed: a write-back cache holding the line marks it dirty, and otherwise
+// the bytes go on below
+void store(struct Cache *c, unsigned long address, unsigned int size) {
+    if (write_back && c->line >= 0) {
+        c->dirty[c->line] = 1;
+        return;
+    }
+    c->write_bytes += size;
+    write_in(1, address, size);
+}
+
+// Take size bytes written by the level above into the level-th level and
+// below: the first write-back level holding the line keeps them, and the
+// others, and memory, see the write pass through. Writes from above are not
+// lookups, so they leave the hit and miss counts and the policies alone.
+void write_in(int level, unsigned long address, unsigned long size) {
+    for (; level < num_levels; level++) {
+        struct Cache *c = levels[level];
+        long line = line_of(c, address);
+        if (write_back && line >= 0) {
+            c->dirty[line] = 1;
+            return;
+        }
+        c->write_bytes += size;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) int find_way_avx2(const unsigned long *tags,
+                                                  unsigned int E,
+                                                  unsigned long tag) {
+    __m256i key = _mm256_set1_epi64x(tag);
+    int i = 0;
+    for (; i + 4 <= E; i += 4) {
+        __m256i ways = _mm256_loadu_si256((const __m256i *)&tags[i]);
+        int mask = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(ways, key)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    for (; i < E; i++) {
+        if (tags[i] == tag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2"))) int find_min_avx2(const unsigned int *stamps,
+                                                  unsigned int E) {
+    __m256i low = _mm256_set1_epi32(-1);
+    unsigned int min = ~0U;
+    int i = 0;
+    for (; i + 8 <= E; i += 8) {
+        low = _mm256_min_epu32(
+            low, _mm256_loadu_si256((const __m256i *)&stamps[i]));
+    }
+    // Reduce the eight lanes, then the rest of the ways
+    low = _mm256_min_epu32(low, _mm256_permute2x128_si256(low, low, 1));
+    low = _mm256_min_epu32(low, _mm256_shuffle_epi32(low, 0x4e));
+    low = _mm256_min_epu32(low, _mm256_shuffle_epi32(low, 0xb1));
+    min = _mm256_cvtsi256_si32(low);
+    for (int j = i; j < E; j++) {
+        min = stamps[j] < min ? stamps[j] : min;
+    }
+    // The first way holding the minimum, as a scalar scan would pick
+    __m256i key = _mm256_set1_epi32(min);
+    for (i = 0; i + 8 <= E; i += 8) {
+        __m256i ways = _mm256_loadu_si256((const __m256i *)&stamps[i]);
+        int mask = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(ways, key)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    while (stamps[i] != min) {
+        i++;
+    }
+    return i;
+}
+#endif
+
+// Find the way of a set holding tag, or -1; matching INVALID_TAG finds the
+// first empty line. Sets of 4 ways or more compare 4 tags at once with AVX2,
+// where the CPU has it.
+int find_way(const unsigned long *tags, unsigned int E, unsigned long tag) {
+#if defined(__x86_64__)
+    if (use_avx2 && E >= 4) {
+        return find_way_avx2(tags, E, tag);
+    }
+#endif
     for (int i = 0; i < E; i++) {
-        if (!cache[set_index][i].is_valid) {
-            return false;
+        if (tags[i] == tag) {
+            return i;
         }
     }
-    return true;
+    return -1;
 }
 
-void evict(unsigned int set_index, unsigned int tag) {
+// Find the first way of a set with the lowest stamp, 8 at once with AVX2
+int find_min(const unsigned int *stamps, unsigned int E) {
+#if defined(__x86_64__)
+    if (use_avx2 && E >= 8) {
+        return find_min_avx2(stamps, E);
+    }
+#endif
     int lru_index = 0;
-    // Find the lru(Least Recently Used) block
     for (int i = 0; i < E; i++) {
-        lru_index = cache[set_index][i].placed_time <
-                            cache[set_index][lru_index].placed_time
-                        ? i
-                        : lru_index;
+        lru_index = stamps[i] < stamps[lru_index] ? i : lru_index;
     }
-    cache[set_index][lru_index].tag = tag;
-    cache[set_index][lru_index].placed_time = time_count;
+    return lru_index;
 }
 
-void place(unsigned int set_index, unsigned int tag) {
-    for (int i = 0; i < E; i++) {
-        // If there is an empty block, place the block
-        if (!cache[set_index][i].is_valid) {
-            cache[set_index][i].is_valid = true;
-            cache[set_index][i].tag = tag;
-            cache[set_index][i].placed_time = time_count;
-            return;
+// Fill the line of address, dirty or not, in the level-th level c, and pass
+// on its victim
+void insert(int level, struct Cache *c, unsigned long address, bool dirty) {
+    unsigned long victim;
+    bool victim_dirty;
+    if (!fill(c, address, dirty, &victim, &victim_dirty)) {
+        return;
+    }
+    // An inclusive level takes its victims out of every level above, and
+    // writes back what they had written to them
+    if (level > 0 && c->relation == INCLUSIVE) {
+        for (int i = 0; i < level; i++) {
+            levels[i]->invalidation_count +=
+                invalidate(levels[i], victim, 1UL << c->b, &victim_dirty);
+        }
+        if (l1i != NULL) {
+            l1i->invalidation_count +=
+                invalidate(l1i, victim, 1UL << c->b, &victim_dirty);
+        }
+    }
+    if (victim_dirty) {
+        c->dirty_eviction_count++;
+        c->write_bytes += 1UL << c->b;
+    }
+    // An exclusive level below holds the victims of the levels above, and
+    // otherwise a dirty victim is written back to the levels below
+    if (level + 1 < num_levels && levels[level + 1]->relation == EXCLUSIVE) {
+        insert(level + 1, levels[level + 1], victim, victim_dirty);
+    } else if (victim_dirty) {
+        write_in(level + 1, victim, 1UL << c->b);
+    }
+}
+
+// Place the line of address in an empty block, or else in the policy's
+// victim; return whether a line was evicted, and its address and whether it
+// was dirty in victim and victim_dirty
+bool fill(struct Cache *c, unsigned long address, bool dirty,
+          unsigned long *victim, bool *victim_dirty) {
+    unsigned long tag = address >> (c->s + c->b);
+    unsigned int set_index = (address >> c->b) & ((1UL << c->s) - 1);
+    unsigned long *set = &c->tags[set_index * c->E];
+    // If there is an empty block, place the block
+    int way = find_way(set, c->E, INVALID_TAG);
+    if (way >= 0) {
+        set[way] = tag;
+        c->line = set_index * c->E + way;
+        c->dirty[c->line] = dirty;
+        c->policy->fill(c, set_index, way);
+        return false;
+    }
+    // Let the policy choose the block to replace
+    way = c->policy->victim(c, set_index);
+    c->eviction_count++;
+    *victim = ((set[way] << c->s) | set_index) << c->b;
+    if (c->report != NULL) {
+        c->report->evictions[report_line(c->report, *victim >> c->b)]++;
+        c->report->set_evictions[set_index]++;
+        find_region(c->report, *victim)->eviction_count++;
+    }
+    c->line = set_index * c->E + way;
+    *victim_dirty = c->dirty[c->line];
+    set[way] = tag;
+    c->dirty[c->line] = dirty;
+    c->policy->fill(c, set_index, way);
+    return true;
+}
+
+// Drop every line of c that holds part of the size bytes at address, set
+// dirty if any of them was, and return how many there were
+int invalidate(struct Cache *c, unsigned long address, unsigned long size,
+               bool *dirty) {
+    int dropped = 0;
+    unsigned long line = address >> c->b;
+    unsigned long last = (address + size - 1) >> c->b;
+    for (; line <= last; line++) {
+        unsigned long tag = line >> c->s;
+        unsigned int set_index = line & ((1UL << c->s) - 1);
+        unsigned long *set = &c->tags[set_index * c->E];
+        int way = find_way(set, c->E, tag);
+        if (way >= 0) {
+            set[way] = INVALID_TAG;
+            *dirty |= c->dirty[set_index * c->E + way];
+            dropped++;
         }
     }
+    return dropped;
+}
+
+void print_level(struct Cache *c) {
+    printf("%-4s hits:%u misses:%u evictions:%u invalidations:%u "
+           "dirty_evictions:%u bytes_written:%lu",
+           c->name, c->hit_count, c->miss_count, c->eviction_count,
+           c->invalidation_count, c->dirty_eviction_count, c->write_bytes);
+    if (c->shadow != NULL) {
+        printf(" compulsory:%u capacity:%u conflict:%u",
+               c->shadow->compulsory_count, c->shadow->capacity_count,
+               c->shadow->conflict_count);
+    }
+    printf("\n");
+}
+
+// xorshift32 for a set, so that random and brrip give the same counts
+// everywhere
+unsigned int next_random(struct Cache *c, unsigned int set_index) {
+    unsigned int *state = &c->random_state[set_index];
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Map the trace file into memory, or read it all if it cannot be mapped
+bool open_trace(struct Trace *t, const char *path) {
+    struct stat st;
+    size_t length = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    t->mapped = false;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            t->data = data;
+            t->mapped = true;
+            length = st.st_size;
+        }
+    }
+    if (!t->mapped) {
+        // A pipe, say: read it into a buffer that doubles as it fills
+        size_t capacity = 1 << 16;
+        char *buffer = (char *)malloc(capacity);
+        for (ssize_t n; (n = read(fd, buffer + length, capacity - length)) > 0;) {
+            length += n;
+            if (length == capacity) {
+                buffer = (char *)realloc(buffer, capacity *= 2);
+            }
+        }
+        t->data = buffer;
+    }
+    close(fd);
+    t->next = t->data;
+    t->end = t->data + length;
+
+    memset(hex_value, 0xff, sizeof(hex_value));
+    for (int i = 0; i < 10; i++) {
+        hex_value['0' + i] = i;
+    }
+    for (int i = 0; i < 6; i++) {
+        hex_value['a' + i] = hex_value['A' + i] = 10 + i;
+    }
+    return true;
+}
+
+// Decode up to max records like " L 04f6b868,8" into batch, and return how
+// many there were (0 at the end of the trace). A record is read as fscanf's
+// " %c %lx,%u" would, and the rest of its line is skipped.
+int read_batch(struct Trace *t, struct Access *batch, int max) {
+    const char *p = t->next, *end = t->end;
+    int n = 0;
+    while (n < max && p < end) {
+        // Skip blank lines and the spaces before the operation
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\t')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        struct Access *a = &batch[n];
+        a->operation = *p++;
+        while (p < end && *p == ' ') {
+            p++;
+        }
+        // The table lookup ends the address at the first non-hex character
+        const char *digits = p;
+        unsigned long address = 0;
+        unsigned char d;
+        while (p < end && (d = hex_value[(unsigned char)*p]) != 0xff) {
+            address = address << 4 | d;
+            p++;
+        }
+        unsigned int size = 0;
+        if (p < end && *p == ',') {
+            for (p++; p < end && (unsigned)(*p - '0') < 10; p++) {
+                size = size * 10 + (*p - '0');
+            }
+        }
+        a->address = address;
+        a->size = size;
+        // A line without an address is not a record
+        n += p > digits;
+        const char *eol = memchr(p, '\n', end - p);
+        p = eol != NULL ? eol + 1 : end;
+    }
+    t->next = p;
+    return n;
+}
+
+void close_trace(struct Trace *t) {
+    if (t->mapped) {
+        munmap((void *)t->data, t->end - t->data);
+    } else {
+        free((void *)t->data);
+    }
+}
+
+// How many lines of 2^b bytes an access counts as: with -a every line its
+// bytes touch, and otherwise one
+unsigned long span(const struct Access *a, unsigned int b) {
+    if (!split_accesses || a->size == 0) {
+        return 1;
+    }
+    return ((a->address + a->size - 1) >> b) - (a->address >> b) + 1;
+}
+
+// Return the address of the part of an access in the k-th line it counts
+// as, and set size to the bytes of the access in that line
+unsigned long piece(const struct Access *a, unsigned int b, unsigned long k,
+                    unsigned int *size) {
+    if (!split_accesses) {
+        *size = a->size;
+        return a->address;
+    }
+    unsigned long start = k == 0 ? a->address : ((a->address >> b) + k) << b;
+    unsigned long end = ((start >> b) + 1) << b;
+    if (end > a->address + a->size) {
+        end = a->address + a->size;
+    }
+    *size = end - start;
+    return start;
+}
+
+// Run the trace through the hierarchy, a line of each record at a time
+void simulate(struct Trace *t) {
+    static struct Access batch[BATCH_SIZE];
+    for (int n; (n = read_batch(t, batch, BATCH_SIZE)) > 0;) {
+        for (int i = 0; i < n; i++) {
+            struct Access *a = &batch[i];
+            // Instruction fetches only go to a split L1
+            struct Cache *l1 = a->operation == 'I' ? l1i : levels[0];
+            if (l1 == NULL) {
+                continue;
+            }
+            bool store = a->operation == 'S' || a->operation == 'M';
+            for (unsigned long k = 0, pieces = span(a, l1->b); k < pieces; k++) {
+                unsigned int size;
+                unsigned long address = piece(a, l1->b, k, &size);
+                // A modify is a load and then a store to the same bytes
+                time_count++;
+                if (a->operation == 'M') {
+                    operate(l1, address, false, size);
+                }
+                operate(l1, address, store, size);
+            }
+        }
+    }
+}
+
+// Run the trace through a single level with num_threads workers: this thread
+// decodes the records and queues each reference, with the time of its record,
+// for the worker owning its set, so that every set sees its references in
+// order and the counts are those of a serial run
+void simulate_parallel(struct Trace *t, int num_threads) {
+    static struct Access batch[BATCH_SIZE];
+    struct Cache *c = levels[0];
+    struct Worker *workers =
+        (struct Worker *)calloc(num_threads, sizeof(struct Worker));
+    unsigned long set_mask = (1UL << c->s) - 1;
+    for (int i = 0; i < num_threads; i++) {
+        struct Worker *w = &workers[i];
+        w->cache = *c;
+        for (int j = 0; j < QUEUE_DEPTH; j++) {
+            w->buffers[j] = (struct Ref *)malloc(BATCH_SIZE * sizeof(struct Ref));
+        }
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->changed, NULL);
+        pthread_create(&w->thread, NULL, simulate_sets, w);
+    }
+
+    for (int n; (n = read_batch(t, batch, BATCH_SIZE)) > 0;) {
+        for (int i = 0; i < n; i++) {
+            struct Access *a = &batch[i];
+            if (a->operation == 'I') {
+                continue;
+            }
+            bool store = a->operation == 'S' || a->operation == 'M';
+            for (unsigned long k = 0, pieces = span(a, c->b); k < pieces; k++) {
+                unsigned int size;
+                unsigned long address = piece(a, c->b, k, &size);
+                unsigned long set_index = (address >> c->b) & set_mask;
+                struct Worker *w =
+                    &workers[(set_index / SET_GROUP) % num_threads];
+                time_count++;
+                if (a->operation == 'M') {
+                    push_ref(w, address, time_count, false, size);
+                }
+                push_ref(w, address, time_count, store, size);
+            }
+        }
+    }
+
+    // Hand over the last references, and add up the counts
+    for (int i = 0; i < num_threads; i++) {
+        struct Worker *w = &workers[i];
+        if (w->filling > 0) {
+            publish(w);
+        }
+        pthread_mutex_lock(&w->lock);
+        w->done = true;
+        pthread_cond_signal(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        struct Worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        c->hit_count += w->cache.hit_count;
+        c->miss_count += w->cache.miss_count;
+        c->eviction_count += w->cache.eviction_count;
+        c->dirty_eviction_count += w->cache.dirty_eviction_count;
+        c->write_bytes += w->cache.write_bytes;
+        for (int j = 0; j < QUEUE_DEPTH; j++) {
+            free(w->buffers[j]);
+        }
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->changed);
+    }
+    free(workers);
+}
+
+// A worker: simulate each batch of references queued for it until the
+// reader is done
+void *simulate_sets(void *arg) {
+    struct Worker *w = (struct Worker *)arg;
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        while (w->count == 0 && !w->done) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->count == 0) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        struct Ref *refs = w->buffers[w->tail];
+        int n = w->lengths[w->tail];
+        pthread_mutex_unlock(&w->lock);
+
+        // As operate does for a single level, which has none below to write
+        // back to
+        for (int i = 0; i < n; i++) {
+            w->cache.time = refs[i].time;
+            bool no_fill = refs[i].write && !write_allocate;
+            if (!lookup(&w->cache, refs[i].address) && !no_fill) {
+                insert(0, &w->cache, refs[i].address, false);
+            }
+            if (refs[i].write) {
+                store(&w->cache, refs[i].address, refs[i].size);
+            }
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->tail = (w->tail + 1) % QUEUE_DEPTH;
+        w->count--;
+        pthread_cond_signal(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+// Queue a reference for a worker, and hand the batch over once it is full
+void push_ref(struct Worker *w, unsigned long address, unsigned int time,
+              bool write, unsigned int size) {
+    struct Ref *r = &w->buffers[w->head][w->filling++];
+    r->address = address;
+    r->time = time;
+    r->write = write;
+    r->size = size;
+    if (w->filling == BATCH_SIZE) {
+        publish(w);
+    }
+}
+
+// Hand the batch being filled over to the worker, and wait until the next
+// buffer of the ring is free
+void publish(struct Worker *w) {
+    pthread_mutex_lock(&w->lock);
+    w->lengths[w->head] = w->filling;
+    w->head = (w->head + 1) % QUEUE_DEPTH;
+    w->count++;
+    pthread_cond_signal(&w->changed);
+    while (w->count == QUEUE_DEPTH) {
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    w->filling = 0;
+}
+
+// Run the trace once and print the LRU hits, misses and evictions of every
+// cache of 2^b-byte lines with up to 2^max_s sets and max_e lines per set,
+// from the stack distance of each access: the number of other lines of its
+// set used since the last access to its line, so that it hits exactly in
+// the caches with more ways than that. Then print the distance histogram of
+// a fully associative cache.
+void sweep(struct Trace *t, unsigned int b, unsigned int max_s,
+           unsigned int max_e) {
+    static struct Access batch[BATCH_SIZE];
+    struct Sweep sweeps[SWEEP_MAX_S + 1];
+    struct Lines lines = {NULL};
+    size_t nodes = 0;
+    unsigned long total = 0;
+    memset(sweeps, 0, sizeof(sweeps));
+    for (unsigned int s = 0; s <= max_s; s++) {
+        struct Sweep *w = &sweeps[s];
+        w->s = s;
+        w->roots = (int *)malloc(sizeof(int) << s);
+        memset(w->roots, 0xff, sizeof(int) << s);
+        w->near = (unsigned long *)calloc(max_e, sizeof(unsigned long));
+    }
+
+    for (int n; (n = read_batch(t, batch, BATCH_SIZE)) > 0;) {
+        for (int i = 0; i < n; i++) {
+            if (batch[i].operation == 'I') {
+                continue;
+            }
+            // Each line of the access in turn, with a time of its own so
+            // that the lines of one record stay apart in a set's stack
+            for (unsigned long k = 0, pieces = span(&batch[i], b); k < pieces;
+                 k++) {
+                time_count++;
+                unsigned long address = (batch[i].address >> b) + k;
+                int line = find_line(&lines, address);
+                // Grow the node arrays with the table of lines
+                if (lines.capacity > nodes) {
+                    nodes = lines.capacity;
+                    for (unsigned int s = 0; s <= max_s; s++) {
+                        struct Sweep *w = &sweeps[s];
+                        w->key = (unsigned int *)realloc(w->key, nodes * sizeof(unsigned int));
+                        w->left = (int *)realloc(w->left, nodes * sizeof(int));
+                        w->right = (int *)realloc(w->right, nodes * sizeof(int));
+                        w->size = (int *)realloc(w->size, nodes * sizeof(int));
+                    }
+                }
+                for (int access = batch[i].operation == 'M' ? 2 : 1; access > 0;
+                     access--) {
+                    unsigned int last = lines.last[line];
+                    total++;
+                    for (unsigned int s = 0; s <= max_s; s++) {
+                        struct Sweep *w = &sweeps[s];
+                        int *root = &w->roots[address & ((1UL << s) - 1)];
+                        int older, newer, self;
+                        if (last == 0) {
+                            w->cold++;
+                        } else {
+                            // The lines used after this one are its distance
+                            split(w, *root, last, &older, &newer);
+                            unsigned int distance = newer < 0 ? 0 : w->size[newer];
+                            if (distance < max_e) {
+                                w->near[distance]++;
+                            } else {
+                                w->far++;
+                            }
+                            int bucket = 0;
+                            while (distance >> bucket) {
+                                bucket++;
+                            }
+                            w->log[bucket]++;
+                            // Take the line out, and put it back as the newest
+                            split(w, older, last - 1, &older, &self);
+                            *root = merge(w, older, newer);
+                        }
+                        w->key[line] = time_count;
+                        w->left[line] = w->right[line] = -1;
+                        w->size[line] = 1;
+                        *root = merge(w, *root, line);
+                    }
+                    lines.last[line] = time_count;
+                }
+            }
+        }
+    }
+
+    for (unsigned int s = 0; s <= max_s; s++) {
+        struct Sweep *w = &sweeps[s];
+        unsigned long hits = 0;
+        for (unsigned int E = 1; E <= max_e; E++) {
+            hits += w->near[E - 1];
+            if ((E & (E - 1)) != 0 && E != max_e) {
+                continue;
+            }
+            // A set fills its empty lines once, and evicts on other misses
+            unsigned long filled = 0;
+            for (unsigned long set = 0; set < (1UL << s); set++) {
+                int root = w->roots[set];
+                unsigned int held = root < 0 ? 0 : w->size[root];
+                filled += held < E ? held : E;
+            }
+            printf("s:%u E:%u bytes:%lu hits:%lu misses:%lu evictions:%lu\n",
+                   s, E, (1UL << (s + b)) * E, hits, total - hits,
+                   total - hits - filled);
+        }
+    }
+    printf("distance 0: %lu\n", sweeps[0].log[0]);
+    for (int i = 1; i < 65; i++) {
+        if (sweeps[0].log[i] > 0) {
+            printf("distance %lu-%lu: %lu\n", 1UL << (i - 1), (1UL << i) - 1,
+                   sweeps[0].log[i]);
+        }
+    }
+    printf("cold: %lu\n", sweeps[0].cold);
+}
+
+// Find the node number of a line, adding it if it is new
+int find_line(struct Lines *lines, unsigned long address) {
+    if (2 * (lines->count + 1) > lines->capacity) {
+        // Rehash into a table twice as large
+        struct Lines old = *lines;
+        lines->capacity = old.capacity ? 2 * old.capacity : 1 << 16;
+        lines->address =
+            (unsigned long *)malloc(lines->capacity * sizeof(unsigned long));
+        lines->node = (int *)malloc(lines->capacity * sizeof(int));
+        memset(lines->node, 0xff, lines->capacity * sizeof(int));
+        lines->last = (unsigned int *)realloc(
+            old.last, lines->capacity * sizeof(unsigned int));
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (old.node[i] >= 0) {
+                size_t j = (old.address[i] * 0x9e3779b97f4a7c15UL) &
+                           (lines->capacity - 1);
+                while (lines->node[j] >= 0) {
+                    j = (j + 1) & (lines->capacity - 1);
+                }
+                lines->address[j] = old.address[i];
+                lines->node[j] = old.node[i];
+            }
+        }
+        free(old.address);
+        free(old.node);
+    }
+    size_t j = (address * 0x9e3779b97f4a7c15UL) & (lines->capacity - 1);
+    for (; lines->node[j] >= 0; j = (j + 1) & (lines->capacity - 1)) {
+        if (lines->address[j] == address) {
+            return lines->node[j];
+        }
+    }
+    lines->address[j] = address;
+    lines->node[j] = lines->count;
+    lines->last[lines->count] = 0;
+    return lines->count++;
+}
+
+// Split a treap into the nodes with keys up to key and those above it
+void split(struct Sweep *w, int root, unsigned int key, int *le, int *gt) {
+    if (root < 0) {
+        *le = *gt = -1;
+    } else if (w->key[root] <= key) {
+        split(w, w->right[root], key, &w->right[root], gt);
+        *le = root;
+        resize(w, root);
+    } else {
+        split(w, w->left[root], key, le, &w->left[root]);
+        *gt = root;
+        resize(w, root);
+    }
+}
+
+// Join two treaps, all of whose keys in l are below those in r; the node
+// priorities are a hash of the node numbers
+int merge(struct Sweep *w, int l, int r) {
+    if (l < 0 || r < 0) {
+        return l < 0 ? r : l;
+    }
+    if ((unsigned int)(l * 2654435761U) > (unsigned int)(r * 2654435761U)) {
+        w->right[l] = merge(w, w->right[l], r);
+        resize(w, l);
+        return l;
+    }
+    w->left[r] = merge(w, l, w->left[r]);
+    resize(w, r);
+    return r;
+}
+
+// Count the nodes of a treap from those of its subtrees
+void resize(struct Sweep *w, int node) {
+    w->size[node] = 1 + (w->left[node] < 0 ? 0 : w->size[w->left[node]]) +
+                    (w->right[node] < 0 ? 0 : w->size[w->right[node]]);
+}
+
+// Make an empty shadow cache of capacity lines
+struct Shadow *new_shadow(size_t capacity) {
+    struct Shadow *h = (struct Shadow *)calloc(1, sizeof(struct Shadow));
+    h->head = h->tail = -1;
+    h->capacity = capacity;
+    return h;
+}
+
+// Access the line at address (shifted right by b) in a shadow cache, making
+// it the most recently used; return whether the shadow held it, and set
+// first if the line had never been seen
+bool shadow_access(struct Shadow *h, unsigned long address, bool *first) {
+    size_t seen = h->lines.count;
+    int node = find_line(&h->lines, address);
+    bool hit = false;
+    *first = h->lines.count > seen;
+    // Grow the node arrays with the table of lines
+    if (h->lines.capacity > h->nodes) {
+        h->nodes = h->lines.capacity;
+        h->prev = (int *)realloc(h->prev, h->nodes * sizeof(int));
+        h->next = (int *)realloc(h->next, h->nodes * sizeof(int));
+        h->held = (unsigned char *)realloc(h->held, h->nodes);
+    }
+    if (*first) {
+        h->held[node] = 0;
+    }
+    if (h->held[node]) {
+        hit = true;
+        unlink_node(h, node);
+    } else if (h->count == h->capacity) {
+        // Evict the least recently used line
+        int victim = h->tail;
+        unlink_node(h, victim);
+        h->held[victim] = 0;
+        h->count--;
+    }
+    if (!hit) {
+        h->held[node] = 1;
+        h->count++;
+    }
+    // Put the line at the head of the list
+    h->prev[node] = -1;
+    h->next[node] = h->head;
+    if (h->head >= 0) {
+        h->prev[h->head] = node;
+    }
+    h->head = node;
+    if (h->tail < 0) {
+        h->tail = node;
+    }
+    return hit;
+}
+
+// Take a line out of the LRU list of a shadow cache
+void unlink_node(struct Shadow *h, int node) {
+    if (h->prev[node] >= 0) {
+        h->next[h->prev[node]] = h->next[node];
+    } else {
+        h->head = h->next[node];
+    }
+    if (h->next[node] >= 0) {
+        h->prev[h->next[node]] = h->prev[node];
+    } else {
+        h->tail = h->prev[node];
+    }
+}
+
+// Make an empty report for the lines and sets of c, with the regions of the
+// map file at map_path (if any): a line "name start end" for each, with the
+// addresses in hex, and # starting a comment
+struct Report *new_report(struct Cache *c, const char *map_path) {
+    struct Report *r = (struct Report *)calloc(1, sizeof(struct Report));
+    r->set_misses = (unsigned long *)calloc(1UL << c->s, sizeof(unsigned long));
+    r->set_evictions =
+        (unsigned long *)calloc(1UL << c->s, sizeof(unsigned long));
+    if (map_path != NULL) {
+        FILE *map = fopen(map_path, "r");
+        char text[256];
+        if (map == NULL) {
+            fprintf(stderr, "cannot read region map %s\n", map_path);
+            exit(1);
+        }
+        while (fgets(text, sizeof(text), map) != NULL) {
+            struct Region *region = &r->regions[r->num_regions];
+            char rest;
+            text[strcspn(text, "#\n")] = '\0';
+            if (sscanf(text, " %c", &rest) != 1) {
+                continue;
+            }
+            if (r->num_regions == MAX_REGIONS ||
+                sscanf(text, "%31s %lx %lx %c", region->name, &region->start,
+                       &region->end, &rest) != 3) {
+                fprintf(stderr, "bad region in %s: %s (use name start end, "
+                                "at most %d of them)\n",
+                        map_path, text, MAX_REGIONS);
+                exit(1);
+            }
+            r->num_regions++;
+        }
+        fclose(map);
+    }
+    strcpy(r->regions[r->num_regions].name, "(other)");
+    return r;
+}
+
+// Find the first region holding address, or the one of the rest
+struct Region *find_region(struct Report *r, unsigned long address) {
+    int i = 0;
+    while (i < r->num_regions &&
+           (address < r->regions[i].start || address >= r->regions[i].end)) {
+        i++;
+    }
+    return &r->regions[i];
+}
+
+// Find the node number of a line (an address shifted right by b) in a
+// report, adding it if it is new
+int report_line(struct Report *r, unsigned long address) {
+    int node = find_line(&r->lines, address);
+    // Grow the counts with the table of lines
+    if (r->lines.capacity > r->nodes) {
+        size_t old = r->nodes;
+        r->nodes = r->lines.capacity;
+        r->misses = (unsigned int *)realloc(r->misses,
+                                            r->nodes * sizeof(unsigned int));
+        r->conflicts = (unsigned int *)realloc(
+            r->conflicts, r->nodes * sizeof(unsigned int));
+        r->evictions = (unsigned int *)realloc(
+            r->evictions, r->nodes * sizeof(unsigned int));
+        memset(r->misses + old, 0, (r->nodes - old) * sizeof(unsigned int));
+        memset(r->conflicts + old, 0, (r->nodes - old) * sizeof(unsigned int));
+        memset(r->evictions + old, 0, (r->nodes - old) * sizeof(unsigned int));
+    }
+    return node;
+}
+
+// Print the counts of every region, and the top lines, ranked by conflict
+// misses with -c or else by misses, and the top sets, ranked by misses
+void print_report(struct Cache *c, int top) {
+    struct Report *r = c->report;
+    bool conflicts = c->shadow != NULL;
+    for (int i = 0; r->num_regions > 0 && i <= r->num_regions; i++) {
+        struct Region *region = &r->regions[i];
+        if (i == r->num_regions && region->access_count == 0) {
+            break;
+        }
+        printf("region %s: accesses:%lu misses:%lu evictions:%lu\n",
+               region->name, region->access_count, region->miss_count,
+               region->eviction_count);
+    }
+    if (top <= 0) {
+        return;
+    }
+
+    struct Hot *hot =
+        (struct Hot *)malloc(r->lines.count * sizeof(struct Hot));
+    int n = 0;
+    for (size_t j = 0; j < r->lines.capacity; j++) {
+        int node = r->lines.node[j];
+        if (node >= 0 && r->misses[node] > 0) {
+            hot[n].address = r->lines.address[j] << c->b;
+            hot[n].count = conflicts ? r->conflicts[node] : r->misses[node];
+            hot[n++].node = node;
+        }
+    }
+    qsort(hot, n, sizeof(struct Hot), compare_hot);
+    for (int i = 0; i < n && i < top; i++) {
+        int node = hot[i].node;
+        printf("line %lx: set:%lu misses:%u", hot[i].address,
+               (hot[i].address >> c->b) & ((1UL << c->s) - 1),
+               r->misses[node]);
+        if (conflicts) {
+            printf(" conflict:%u", r->conflicts[node]);
+        }
+        printf(" evictions:%u", r->evictions[node]);
+        if (r->num_regions > 0) {
+            printf(" %s", find_region(r, hot[i].address)->name);
+        }
+        printf("\n");
+    }
+    free(hot);
+
+    hot = (struct Hot *)malloc(sizeof(struct Hot) << c->s);
+    for (unsigned long set = 0; set < (1UL << c->s); set++) {
+        hot[set].address = set;
+        hot[set].count = r->set_misses[set];
+    }
+    qsort(hot, 1UL << c->s, sizeof(struct Hot), compare_hot);
+    for (unsigned long i = 0; i < (1UL << c->s) && i < top; i++) {
+        if (hot[i].count == 0) {
+            break;
+        }
+        printf("set %lu: misses:%lu evictions:%lu\n", hot[i].address,
+               r->set_misses[hot[i].address],
+               r->set_evictions[hot[i].address]);
+    }
+    free(hot);
+}
+
+// Order lines or sets by count, the highest first, and then by address
+int compare_hot(const void *a, const void *b) {
+    const struct Hot *x = (const struct Hot *)a, *y = (const struct Hot *)b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return x->address < y->address ? -1 : x->address > y->address;
 }
 
 int main(int argc, char *argv[]) {
     // Parse s, E and b which are in terminal command like "./csim -s 1 -E 1 -b
-    // 1 -t traces/yi2.trace"
-    FILE *trace_file;
-    for (int arg; (arg = getopt(argc, argv, "s:E:b:t:")) != -1;) {
+    // 1 -t traces/yi2.trace", and the replacement policy (-p, LRU by default).
+    // -i adds an L1 instruction cache, and each -l a level below the L1.
+    // -w sets the write policy of every level, like "through,noallocate",
+    // -a splits each access into every line it touches, and -c sorts the
+    // misses of every level into compulsory, capacity and conflict misses.
+    // -r counts the L1 misses and evictions in each region of a map file,
+    // and -H prints the N lines and sets of the L1 with the most misses.
+    // -j simulates a single level with that many threads, and -W sweeps
+    // LRU caches of up to 2^s sets and E lines instead.
+    const char *trace_path = NULL;
+    unsigned int s = 0, E = 0, b = 0;
+    const char *policy_name = "lru";
+    char *l1i_spec = NULL;
+    char *lower_specs[MAX_LEVELS];
+    int num_lower = 0;
+    int num_threads = 1;
+    bool classify = false;
+    bool write_policy = false;
+    const char *map_path = NULL;
+    int top = 0;
+    unsigned int sweep_s = 0, sweep_e = 0;
+    for (int arg; (arg = getopt(argc, argv, "s:E:b:t:p:i:l:w:acr:H:j:W:")) != -1;) {
         switch (arg) {
         case 's':
             s = atoi(optarg);
@@ -100,7 +1471,60 @@ int main(int argc, char *argv[]) {
             b = atoi(optarg);
             break;
         case 't':
-            trace_file = fopen(optarg, "r");
+            trace_path = optarg;
+            break;
+        case 'p':
+            policy_name = optarg;
+            break;
+        case 'i':
+            l1i_spec = optarg;
+            break;
+        case 'l':
+            if (num_lower == MAX_LEVELS - 1) {
+                fprintf(stderr, "at most %d levels\n", MAX_LEVELS);
+                exit(1);
+            }
+            lower_specs[num_lower++] = optarg;
+            break;
+        case 'w': {
+            char *hit = strtok(optarg, ","), *miss = strtok(NULL, ",");
+            if (hit == NULL || miss == NULL ||
+                (strcmp(hit, "back") != 0 && strcmp(hit, "through") != 0) ||
+                (strcmp(miss, "allocate") != 0 &&
+                 strcmp(miss, "noallocate") != 0)) {
+                fprintf(stderr, "-w needs back or through, then allocate or "
+                                "noallocate\n");
+                exit(1);
+            }
+            write_back = strcmp(hit, "back") == 0;
+            write_allocate = strcmp(miss, "allocate") == 0;
+            write_policy = true;
+            break;
+        }
+        case 'a':
+            split_accesses = true;
+            break;
+        case 'c':
+            classify = true;
+            break;
+        case 'r':
+            map_path = optarg;
+            break;
+        case 'H':
+            top = atoi(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'W':
+            if (sscanf(optarg, "%u,%u", &sweep_s, &sweep_e) != 2 ||
+                sweep_s > SWEEP_MAX_S || sweep_e < 1 ||
+                sweep_e > SWEEP_MAX_E) {
+                fprintf(stderr, "-W needs s,E with s <= %d and "
+                                "1 <= E <= %d\n",
+                        SWEEP_MAX_S, SWEEP_MAX_E);
+                exit(1);
+            }
             break;
             // default:
             //     printf("wrong input\n");
@@ -108,35 +1532,90 @@ int main(int argc, char *argv[]) {
         }
     }
 
+#if defined(__x86_64__)
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    // Read trace file, a batch of decoded records at a time
+    struct Trace trace;
+    if (trace_path == NULL || !open_trace(&trace, trace_path)) {
+        fprintf(stderr, "cannot read trace file %s\n",
+                trace_path != NULL ? trace_path : "(none, use -t)");
+        exit(1);
+    }
+    if (sweep_e > 0) {
+        sweep(&trace, b, sweep_s, sweep_e);
+        close_trace(&trace);
+        return 0;
+    }
+
     // Initialize cache
-    int S = 1 << s;
-    cache = (struct Block **)malloc(sizeof(struct Block *) * S);
-    for (int i = 0; i < S; i++) {
-        cache[i] = (struct Block *)malloc(sizeof(struct Block) * E);
-        for (int j = 0; j < E; j++) {
-            cache[i][j].is_valid = false;
-            cache[i][j].tag = 0;
-            cache[i][j].placed_time = time_count;
+    static char names[MAX_LEVELS][8];
+    bool hierarchy = l1i_spec != NULL || num_lower > 0;
+    // Sets of one level are independent, but levels pass lines between them,
+    // and the shadow cache of -c and the report of -r and -H hold the lines
+    // of every set
+    bool report = map_path != NULL || top > 0;
+    if (num_threads < 1 ||
+        (num_threads > 1 && (hierarchy || classify || report))) {
+        fprintf(stderr, "-j needs a positive number, and a single level "
+                        "without -c, -r or -H\n");
+        exit(1);
+    }
+    levels[num_levels++] =
+        new_cache(l1i_spec != NULL ? "L1D" : "L1", s, E, b, policy_name);
+    if (l1i_spec != NULL) {
+        l1i = parse_level("L1I", l1i_spec);
+    }
+    for (int i = 0; i < num_lower; i++) {
+        sprintf(names[i], "L%d", i + 2);
+        levels[num_levels++] = parse_level(names[i], lower_specs[i]);
+    }
+    for (int i = 0; classify && i <= num_levels; i++) {
+        struct Cache *c = i < num_levels ? levels[i] : l1i;
+        if (c != NULL) {
+            c->shadow = new_shadow(((size_t)1 << c->s) * c->E);
         }
     }
+    if (report) {
+        levels[0]->report = new_report(levels[0], map_path);
+    }
 
-    // Read trace file
-    char operation;
-    unsigned int address, size;
-    // Input type of address is hexadecimal
-    while (fscanf(trace_file, " %c %x,%u", &operation, &address, &size) !=
-           EOF) {
-        if (operation == 'I') {
-            continue;
+    if (num_threads > 1) {
+        simulate_parallel(&trace, num_threads);
+    } else {
+        simulate(&trace);
+    }
+    close_trace(&trace);
+
+    // Print result, for every level of a hierarchy
+    if (hierarchy) {
+        if (l1i != NULL) {
+            print_level(l1i);
+        }
+        for (int i = 0; i < num_levels; i++) {
+            print_level(levels[i]);
         }
-        time_count++;
-        operate(address);
-        if (operation == 'M') {
-            operate(address);
+        if (report) {
+            print_report(levels[0], top);
         }
+        return 0;
+    }
+    printSummary(levels[0]->hit_count, levels[0]->miss_count,
+                 levels[0]->eviction_count);
+    // The summary alone is csim-ref's output
+    if (write_policy) {
+        printf("dirty_evictions:%u bytes_written:%lu\n",
+               levels[0]->dirty_eviction_count, levels[0]->write_bytes);
+    }
+    if (classify) {
+        printf("compulsory:%u capacity:%u conflict:%u\n",
+               levels[0]->shadow->compulsory_count,
+               levels[0]->shadow->capacity_count,
+               levels[0]->shadow->conflict_count);
+    }
+    if (report) {
+        print_report(levels[0], top);
     }
-
-    // Print result
-    printSummary(hit_count, miss_count, eviction_count);
     return 0;
 }
@@ -84,6 +84,16 @@ int main(int argc, char* argv[]){
             (unsigned long long int) &MARKER_END );
     fclose(marker_fp);
 
+    /* Record the regions of A and B, for csim -r */
+    FILE* regions_fp = fopen(".regions","w");
+    assert(regions_fp);
+    fprintf(regions_fp, "A %llx %llx\nB %llx %llx\n",
+            (unsigned long long int) &A[0][0],
+            (unsigned long long int) &A[0][0] + sizeof(int)*M*N,
+            (unsigned long long int) &B[0][0],
+            (unsigned long long int) &B[0][0] + sizeof(int)*M*N );
+    fclose(regions_fp);
+
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
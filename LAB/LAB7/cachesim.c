@@ -0,0 +1,127 @@
+/*
+ * cachesim.c - A set-associative LRU cache model, after the cache
+ *     simulator of the Cache Lab (LAB5/csim.c)
+ *
+ * mm.c feeds it when built with -DMM_CACHESIM (make mdriver-cachesim):
+ * its GET/PUT and free list macros then pass every address through
+ * cachesim_ref, so mdriver can count the misses caused by the
+ * allocator's own metadata traffic without an external tool.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "cachesim.h"
+
+/* One cache line */
+typedef struct {
+    int valid;
+    unsigned long tag;
+    unsigned long placed_time;  /* time of the last reference (for LRU) */
+} line_t;
+
+static int s = CACHESIM_S, E = CACHESIM_E, b = CACHESIM_B;
+static line_t *cache = NULL;    /* 2^s sets of E lines each */
+static int recording = 0;       /* set between cachesim_start and _stop */
+static unsigned long time_count;
+static cachesim_counts_t counts;
+
+static void operate(unsigned long address);
+
+/*
+ * cachesim_init - Set the cache geometry: 2^s sets, E lines per set
+ *     and 2^b bytes per line
+ */
+int cachesim_init(int s_arg, int E_arg, int b_arg)
+{
+    if (s_arg < 0 || s_arg > 20 || E_arg < 1 || E_arg > 1024 ||
+	b_arg < 2 || b_arg > 12)
+	return -1;
+    s = s_arg;
+    E = E_arg;
+    b = b_arg;
+    free(cache);
+    cache = NULL;
+    return 0;
+}
+
+/*
+ * cachesim_start - Empty the cache and the counts, and start counting
+ */
+void cachesim_start(void)
+{
+    size_t i, n = ((size_t)1 << s) * E;
+
+    if (cache == NULL && (cache = malloc(n * sizeof(line_t))) == NULL) {
+	fprintf(stderr, "cachesim: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	cache[i].valid = 0;
+    time_count = 0;
+    counts.refs = counts.hits = counts.misses = counts.evictions = 0;
+    recording = 1;
+}
+
+/*
+ * cachesim_stop - Stop counting, and return the counts since the start
+ */
+void cachesim_stop(cachesim_counts_t *countsp)
+{
+    recording = 0;
+    *countsp = counts;
+}
+
+/*
+ * cachesim_ref - Record a reference to size bytes at addr. A reference
+ *     that straddles a line boundary touches every line it covers.
+ */
+void *cachesim_ref(void *addr, int size)
+{
+    unsigned long line, last;
+
+    if (!recording)
+	return addr;
+    counts.refs++;
+    time_count++;
+    last = ((unsigned long)addr + size - 1) >> b;
+    for (line = (unsigned long)addr >> b; line <= last; line++)
+	operate(line);
+    return addr;
+}
+
+/*
+ * operate - Look up one line address (the address shifted right by b),
+ *     and on a miss fill the first invalid line of its set or else
+ *     evict the least recently used one
+ */
+static void operate(unsigned long line)
+{
+    line_t *set = &cache[(line & ((1UL << s) - 1)) * E];
+    unsigned long tag = line >> s;
+    int i, victim = -1;
+
+    for (i = 0; i < E; i++) {
+	if (set[i].valid && set[i].tag == tag) {
+	    set[i].placed_time = time_count;
+	    counts.hits++;
+	    return;
+	}
+    }
+
+    counts.misses++;
+    for (i = 0; i < E; i++) {
+	if (!set[i].valid) {
+	    victim = i;
+	    break;
+	}
+    }
+    if (victim < 0) {
+	counts.evictions++;
+	victim = 0;
+	for (i = 1; i < E; i++)
+	    if (set[i].placed_time < set[victim].placed_time)
+		victim = i;
+    }
+    set[victim].valid = 1;
+    set[victim].tag = tag;
+    set[victim].placed_time = time_count;
+}
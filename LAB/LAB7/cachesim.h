@@ -0,0 +1,32 @@
+/*
+ * cachesim.h - A set-associative cache model for the references that
+ *     an instrumented mm.c makes to its own heap metadata
+ */
+#ifndef __CACHESIM_H_
+#define __CACHESIM_H_
+
+/* Default geometry: 2^6 sets of 8 lines of 2^6 bytes (a 32KB L1D) */
+#define CACHESIM_S 6
+#define CACHESIM_E 8
+#define CACHESIM_B 6
+
+typedef struct {
+    double refs;       /* references (an unaligned one may span lines) */
+    double hits;
+    double misses;
+    double evictions;
+} cachesim_counts_t;
+
+/* Set the cache geometry. Returns -1 if it is unreasonable */
+int cachesim_init(int s, int E, int b);
+
+/* Empty the cache and the counts, and start counting references */
+void cachesim_start(void);
+
+/* Stop counting references, and return the counts since the start */
+void cachesim_stop(cachesim_counts_t *counts);
+
+/* Record a reference to size bytes at addr, and return addr */
+void *cachesim_ref(void *addr, int size);
+
+#endif /* __CACHESIM_H_ */
@@ -21,9 +21,10 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (the same code works on x86-64)
  *******************************************************/
 
 
@@ -109,6 +110,13 @@ static unsigned int counterRoutine[] =
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
 
+/* Set *hi and *lo to the high and low order bits of the cycle counter */
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    *hi = 0;
+    *lo = counter();
+}
+
 void start_counter()
 {
     /* Get cycle counter */
@@ -143,6 +151,14 @@ double get_counter()
  * haven't provided a Sparc version here.
  ***************************************************************/
 
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    printf("ERROR: You are trying to use an access_counter routine in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    printf("Please choose another timing package in config.h.\n");
+    exit(1);
+}
+
 void start_counter()
 {
     printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
@@ -1,5 +1,8 @@
 /* Routines for using cycle counter */
 
+/* Read the raw cycle counter into its high and low order 32 bits */
+void access_counter(unsigned *hi, unsigned *lo);
+
 /* Start the counter */
 void start_counter();
 
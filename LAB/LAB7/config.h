@@ -77,11 +77,19 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Maximum number of heap regions, including the main heap that
+ * mem_sbrk extends (see mem_region_create in memlib.c)
+ */
+#define MAX_REGIONS 64
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_PERF   1   /* clock_gettime plus hardware counters via 
+			  perf_event_open (counters on Linux only) */
 
 #endif /* __CONFIG_H */
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,8 +21,9 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES (1<<19)  /* Max cache size in bytes (if not in sysfs) */
+#define CACHE_BLOCK 32       /* Cache block size in bytes (if not in sysfs) */
+#define CACHE_SYSFS "/sys/devices/system/cpu/cpu0/cache" /* Linux only */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -30,11 +32,13 @@ static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static int cache_known = 0;  /* set once the cache geometry is settled */
 
 static int *cache_buf = NULL;
 
 static double *values = NULL;
 static int samplecount = 0;
+static double spread = 0;  /* K-best spread of the last call to fcyc */
 
 /* for debugging only */
 #define KEEP_VALS 0
@@ -97,6 +101,57 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*
+ * detect_cache - Size the cache clearing buffer from the cache hierarchy
+ *     described in sysfs. Caches may be exclusive and need not use true
+ *     LRU replacement, so the buffer is 1.5 times the combined size of
+ *     the data and unified caches, swept with their line size. Keeps 
+ *     the defaults if sysfs has no cache information.
+ */
+static void detect_cache()
+{
+    char path[256], type[32];
+    FILE *fp;
+    int i, size, line, total = 0, maxline = 0;
+    char unit;
+
+    cache_known = 1;
+    for (i = 0; ; i++) {
+	sprintf(path, "%s/index%d/type", CACHE_SYSFS, i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%31s", type) != 1)
+	    type[0] = '\0';
+	fclose(fp);
+	if (!strcmp(type, "Instruction"))
+	    continue;
+
+	sprintf(path, "%s/index%d/size", CACHE_SYSFS, i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	unit = '\0';
+	if (fscanf(fp, "%d%c", &size, &unit) < 1)
+	    size = 0;
+	fclose(fp);
+	if (unit == 'K')
+	    size <<= 10;
+	else if (unit == 'M')
+	    size <<= 20;
+	total += size;
+
+	sprintf(path, "%s/index%d/coherency_line_size", CACHE_SYSFS, i);
+	if ((fp = fopen(path, "r")) != NULL) {
+	    if (fscanf(fp, "%d", &line) == 1 && line > maxline)
+		maxline = line;
+	    fclose(fp);
+	}
+    }
+    if (total > 0)
+	cache_bytes = total + total/2;
+    if (maxline > 0)
+	cache_block = maxline;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -106,7 +161,10 @@ static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    int incr;
+    if (!cache_known)
+	detect_cache();
+    incr = cache_block/sizeof(int);
     if (!cache_buf) {
 	cache_buf = malloc(cache_bytes);
 	if (!cache_buf) {
@@ -160,6 +218,8 @@ double fcyc(test_funct f, void *argp)
     }
 #endif
     result = values[0];
+    spread = (samplecount >= kbest && result > 0) ? 
+	(values[kbest-1] - result) / result : 0;
 #if !KEEP_VALS
     free(values); 
     values = NULL;
@@ -167,6 +227,39 @@ double fcyc(test_funct f, void *argp)
     return result;  
 }
 
+/*
+ * get_fcyc_spread - Relative difference between the K-th best and the
+ *     best sample of the last call to fcyc. It bounds the measurement
+ *     noise when fcyc converged and exceeds epsilon when it did not.
+ */
+double get_fcyc_spread()
+{
+    return spread;
+}
+
+/*
+ * fcyc_clear_cache - Evict everything from the caches by sweeping a
+ *     buffer larger than the cache hierarchy. Other timers use this 
+ *     to take cold-cache measurements.
+ */
+void fcyc_clear_cache()
+{
+    clear();
+}
+
+/*
+ * get_fcyc_cache_size - Size in bytes of the buffer used to clear the
+ *     cache, and (in *block) the stride used to sweep it
+ */
+int get_fcyc_cache_size(int *block)
+{
+    if (!cache_known)
+	detect_cache();
+    if (block)
+	*block = cache_block;
+    return cache_bytes;
+}
+
 
 /*************************************************************
  * Set the various parameters used by the measurement routines 
@@ -184,10 +277,11 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 1.5 times the caches listed in sysfs, else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes)
 {
+    cache_known = 1;
     if (bytes != cache_bytes) {
 	cache_bytes = bytes;
 	if (cache_buf) {
@@ -199,9 +293,11 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size listed in sysfs, else 32
  */
 void set_fcyc_cache_block(int bytes) {
+    if (!cache_known)
+	detect_cache();
     cache_block = bytes;
 }
 
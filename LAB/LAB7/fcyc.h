@@ -13,6 +13,15 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Relative spread of the K best samples in the last call to fcyc */
+double get_fcyc_spread();
+
+/* Evict everything from the caches (used for cold-cache timing) */
+void fcyc_clear_cache();
+
+/* Size of the cache clearing buffer, and in *block its sweep stride */
+int get_fcyc_cache_size(int *block);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -26,13 +35,13 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 1.5 times the caches listed in sysfs, else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size listed in sysfs, else 32
  */
 void set_fcyc_cache_block(int bytes);
 
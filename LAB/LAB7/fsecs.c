@@ -6,17 +6,29 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "perfctr.h"
 #include "config.h"
 
+#define NRUNS 10    /* runs averaged by the interval and clock timers */
+#define KBEST 3     /* samples used to estimate the noise of those runs */
+
 static double Mhz;  /* estimated CPU clock frequency */
+static perf_counts_t counts; /* counters from the last call to fsecs */
+static int cache_mode = FSECS_DEFAULT; /* see set_fsecs_cache_mode */
+static double noise;  /* K-best spread of the last call to fsecs */
 
 extern int verbose; /* -v option in mdriver.c */
 
+static double time_runs(fsecs_test_funct f, void *argp, int n, 
+			perf_counts_t *countsp);
+
 /*
  * init_fsecs - initialize the timing package
  */
 void init_fsecs(void)
 {
+    int bytes, block;
+
     Mhz = 0; /* keep gcc -Wall happy */
 
 #if USE_FCYC
@@ -25,7 +37,7 @@ void init_fsecs(void)
 
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
+    set_fcyc_clear_cache(cache_mode != FSECS_WARM);
     set_fcyc_compensate(1);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
@@ -36,7 +48,35 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_PERF
+    if (perf_open() > 0) {
+	if (verbose)
+	    printf("Measuring performance with clock_gettime() and hardware counters.\n");
+    }
+    else if (verbose)
+	printf("Measuring performance with clock_gettime() (no hardware counters).\n");
 #endif
+
+    if (verbose && cache_mode == FSECS_COLD) {
+	bytes = get_fcyc_cache_size(&block);
+	printf("Cold caches: sweeping %d KB in %d-byte steps before each run.\n",
+	       bytes >> 10, block);
+    }
+    else if (verbose && cache_mode == FSECS_WARM)
+	printf("Warm caches: one untimed run before timing.\n");
+}
+
+/*
+ * set_fsecs_cache_mode - Choose the state of the caches for each
+ *    measured run. FSECS_COLD clears the caches before every run and
+ *    times each run on its own. FSECS_WARM makes one untimed run first
+ *    and never clears the caches. FSECS_DEFAULT keeps the historical
+ *    behavior of the selected timer (fcyc clears the caches, the other
+ *    timers do neither). Call before init_fsecs.
+ */
+void set_fsecs_cache_mode(int mode)
+{
+    cache_mode = mode;
 }
 
 /*
@@ -45,13 +85,93 @@ void init_fsecs(void)
 double fsecs(fsecs_test_funct f, void *argp) 
 {
 #if USE_FCYC
-    double cycles = fcyc(f, argp);
+    double cycles;
+
+    if (cache_mode == FSECS_WARM)
+	f(argp);
+    cycles = fcyc(f, argp);
+    noise = get_fcyc_spread();
     return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+#else
+    perf_counts_t one;
+    double samples[NRUNS], secs = 0;
+    int i, j, c;
+
+    if (cache_mode == FSECS_WARM)
+	f(argp);
+
+    /* 
+     * Time each run on its own, so that the spread of the K best runs
+     * tells how noisy the measurement is. Cold runs clear the caches
+     * outside of the timed region.
+     */
+    for (c = 0; c < PERF_NCOUNTERS; c++) {
+	counts.valid[c] = 1;
+	counts.val[c] = 0;
+    }
+    for (i = 0; i < NRUNS; i++) {
+	if (cache_mode == FSECS_COLD)
+	    fcyc_clear_cache();
+	samples[i] = time_runs(f, argp, 1, &one);
+	secs += samples[i];
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+	    counts.valid[c] &= one.valid[c];
+	    counts.val[c] += one.val[c] / NRUNS;
+	}
+
+	/* keep the samples sorted */
+	for (j = i; j > 0 && samples[j-1] > samples[j]; j--) {
+	    double temp = samples[j-1];
+	    samples[j-1] = samples[j];
+	    samples[j] = temp;
+	}
+    }
+    noise = (samples[0] > 0) ? (samples[KBEST-1] - samples[0]) / samples[0] : 0;
+    return secs / NRUNS;
 #endif 
 }
 
+/*
+ * fsecs_noise - Return the relative spread of the K best timing samples
+ *    taken by the last call to fsecs. Differences in running time
+ *    smaller than this are not significant.
+ */
+double fsecs_noise(void)
+{
+    return noise;
+}
+
+/*
+ * time_runs - Return the average running time of n back-to-back runs
+ *    of f, using the timer selected in config.h, and the hardware
+ *    counters for an average run in *countsp
+ */
+static double time_runs(fsecs_test_funct f, void *argp, int n, 
+			perf_counts_t *countsp)
+{
+    double secs = 0;
+    int i;
 
+    perf_start();
+#if USE_ITIMER
+    secs = ftimer_itimer(f, argp, n);
+#elif USE_GETTOD
+    secs = ftimer_gettod(f, argp, n);
+#elif USE_PERF
+    secs = ftimer_clock(f, argp, n);
+#endif
+    perf_stop(countsp);
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	countsp->val[i] /= n;
+    return secs;
+}
+
+/*
+ * fsecs_counters - Return the hardware counters for one run of the 
+ *    function measured by the last call to fsecs. No counter is valid
+ *    unless USE_PERF is set and perf events are available.
+ */
+void fsecs_counters(perf_counts_t *countsp)
+{
+    *countsp = counts;
+}
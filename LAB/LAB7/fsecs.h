@@ -1,4 +1,18 @@
+#include "perfctr.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
+/* Cache state for each measured run, see set_fsecs_cache_mode */
+#define FSECS_DEFAULT 0   /* whatever the selected timer does */
+#define FSECS_COLD    1   /* clear the caches before every run */
+#define FSECS_WARM    2   /* one untimed warm-up run, never clear */
+
+void set_fsecs_cache_mode(int mode);
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Relative spread of the K best samples taken by the last call to fsecs */
+double fsecs_noise(void);
+
+/* Hardware counters for one run of f during the last call to fsecs */
+void fsecs_counters(perf_counts_t *counts);
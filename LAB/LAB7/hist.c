@@ -0,0 +1,75 @@
+/*
+ * hist.c - Log-bucketed latency histograms in the style of HdrHistogram
+ *
+ * Recording a value is a handful of shifts and an increment, cheap
+ * enough to do for every request in a trace.
+ */
+#include <string.h>
+#include "hist.h"
+
+/* bucket_index - Map a value to the index of its bucket */
+static int bucket_index(unsigned long long val)
+{
+    int msb;
+
+    if (val < HIST_SUB)
+	return (int)val;
+    msb = 63 - __builtin_clzll(val);   /* msb >= HIST_SUBBITS */
+    return HIST_SUB + (msb - HIST_SUBBITS) * HIST_SUB +
+	(int)((val >> (msb - HIST_SUBBITS)) - HIST_SUB);
+}
+
+/* bucket_top - Return the largest value that maps to bucket i */
+static unsigned long long bucket_top(int i)
+{
+    int shift;
+    unsigned long long sub;
+
+    if (i < HIST_SUB)
+	return i;
+    shift = (i - HIST_SUB) / HIST_SUB;
+    sub = HIST_SUB + (i - HIST_SUB) % HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * hist_init - Empty a histogram
+ */
+void hist_init(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_add - Record one value
+ */
+void hist_add(hist_t *h, unsigned long long val)
+{
+    h->buckets[bucket_index(val)]++;
+    h->count++;
+    if (val > h->max)
+	h->max = val;
+}
+
+/*
+ * hist_percentile - Return the value at the pct-th percentile
+ */
+unsigned long long hist_percentile(hist_t *h, double pct)
+{
+    unsigned long long rank, seen = 0, top;
+    int i;
+
+    if (h->count == 0)
+	return 0;
+    rank = (unsigned long long)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen >= rank) {
+	    top = bucket_top(i);
+	    return (top < h->max) ? top : h->max;
+	}
+    }
+    return h->max;
+}
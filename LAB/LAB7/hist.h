@@ -0,0 +1,32 @@
+/*
+ * hist.h - Log-bucketed latency histograms
+ */
+
+/*
+ * Values below HIST_SUB get a bucket each. Above that, every power of
+ * two is split into HIST_SUB equal buckets, so a recorded value is
+ * off by at most 1/HIST_SUB (about 3%) while the whole 64-bit range
+ * fits in HIST_BUCKETS counters.
+ */
+#define HIST_SUBBITS 5
+#define HIST_SUB     (1 << HIST_SUBBITS)
+#define HIST_BUCKETS (HIST_SUB + (64 - HIST_SUBBITS) * HIST_SUB)
+
+typedef struct {
+    unsigned long long count;   /* number of recorded values */
+    unsigned long long max;     /* largest recorded value (exact) */
+    unsigned long long buckets[HIST_BUCKETS];
+} hist_t;
+
+/* Empty a histogram */
+void hist_init(hist_t *h);
+
+/* Record one value */
+void hist_add(hist_t *h, unsigned long long val);
+
+/* 
+ * Return the value at or below which pct percent of the recorded 
+ * values lie, rounded up to the top of its bucket (never more than 
+ * the maximum). Returns 0 if the histogram is empty.
+ */
+unsigned long long hist_percentile(hist_t *h, double pct);
@@ -7,18 +7,29 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "hist.h"
+#include "cachesim.h"
 #include "config.h"
 
 /**********************
@@ -30,6 +41,25 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Concurrent benchmark (-T) */
+#define MT_REPS        5 /* keep the best of this many runs per thread count */
+#define MT_QUEUE    1024 /* capacity of each producer/consumer handoff queue */
+#define MT_ALLOCS 100000 /* allocations per thread in producer/consumer mode */
+#define MT_MAXSIZE   512 /* largest block in producer/consumer mode */
+
+/* Latency mode (-L) */
+#define LAT_PASSES    10 /* replays of each trace in latency mode */
+#define LAT_CALIBRATE 10000 /* timer reads used to measure their overhead */
+
+/* Payload access mode (-A) */
+#define TOUCH_BLOCKS   4 /* live blocks accessed after every request */
+#define TOUCH_STRIDE  64 /* bytes between accesses within a block */
+
+/* Baseline comparison (--compare) */
+#define CMP_MIN_NOISE   0.02 /* never flag throughput changes below 2% */
+#define CMP_NOISE_SCALE  2.0 /* tolerance in units of the measured noise */
+#define CMP_UTIL_EPS   0.001 /* never flag utilization drops below 0.1% */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -72,19 +102,127 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Latency percentiles, in cycles, for one type of request on one trace */
+typedef struct {
+    double count;    /* number of timed requests (0 if none) */
+    double p50;      /* median */
+    double p99;
+    double p999;
+    double max;
+} lat_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double noise;    /* relative spread of the K best timing samples */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only in latency mode (-L), indexed by traceop_t type */
+    lat_t lat[3];
+
+    /* hardware counters for one timed run of the trace (if available) */
+    perf_counts_t perf;
+
+    /* defined only in payload access mode (-A) */
+    double touch_secs;        /* secs to run the trace and the accesses */
+    perf_counts_t touch_perf; /* hardware counters for one such run */
+
+    /* defined only in cache model mode (-M), for mm.c's metadata */
+    cachesim_counts_t sim;
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Patterns of payload accesses between requests (-A) */
+typedef enum {
+    TOUCH_NONE,      /* never touch payloads (the default) */
+    TOUCH_SEQ,       /* sweep the live blocks round-robin */
+    TOUCH_RAND,      /* access live blocks chosen at random */
+    TOUCH_RECENT     /* access the most recently allocated live blocks */
+} touch_pattern_t;
+
+/* One trace of a results file read back by --compare */
+typedef struct {
+    char file[MAXLINE]; /* trace file name */
+    int valid;          /* was the trace processed correctly? */
+    double util;        /* space utilization */
+    double kops;        /* throughput in Kops/sec */
+    double noise;       /* relative spread of the K best timing samples */
+} baseline_t;
+
+/* 
+ * A worker process sends one of these back to the parent over a pipe
+ * for each trace it evaluates in parallel (-j) mode. The record is
+ * smaller than PIPE_BUF, so concurrent writes from workers never mix.
+ */
+typedef struct {
+    int tracenum;    /* index of the trace in the tracefiles array */
+    int errors;      /* number of errors the worker found on this trace */
+    stats_t stats;   /* stats for this trace */
+} result_t;
+
+/* 
+ * An allocator that can be driven by several threads at once in the
+ * concurrent benchmark. init, if not NULL, resets it before each run.
+ */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} engine_t;
+
+/* Params to eval_touch_speed, which is timed by fsecs */
+typedef struct {
+    trace_t *trace;
+    engine_t *engine;
+    int *live;       /* ids of the live blocks... */
+    int *pos;        /* ... and the index of each id in live, or -1 */
+    int *sizes;      /* payload size of each live block */
+    int *older;      /* live blocks in allocation order: the next older */
+    int *newer;      /*    and the next newer id of each, or -1 */
+} touch_t;
+
+/* A lock-protected queue that hands blocks from one thread to another */
+typedef struct {
+    pthread_mutex_t lock;
+    void *slots[MT_QUEUE];
+    int head;        /* index of the oldest block in slots */
+    int count;       /* number of blocks in slots */
+} mt_queue_t;
+
+/* State shared by all of the threads in one concurrent run */
+typedef struct {
+    engine_t *engine;
+    int nthreads;
+    trace_t **traces;         /* tracefiles replayed by every thread... */
+    int num_traces;           /* ... and how many of them there are */
+    int producer_consumer;    /* if set, run the synthetic pattern instead */
+    mt_queue_t *queues;       /* one inbox per thread (producer_consumer) */
+    volatile long freed;      /* blocks freed so far (producer_consumer) */
+    volatile int failed;      /* set if any allocation request failed */
+    pthread_barrier_t start;  /* releases all threads at once */
+} mt_run_t;
+
+/* Per-thread arguments for one concurrent run */
+typedef struct {
+    mt_run_t *run;
+    int id;          /* thread number, 0..nthreads-1 */
+    char **blocks;   /* this thread's private copy of trace->blocks */
+    double start;    /* when this thread started working (secs) */
+    double end;      /* when this thread finished (secs) */
+} mt_thread_t;
+
+/* Evaluates one tracefile and fills in its stats_t */
+typedef void (*eval_funct)(char *tracedir, char *filename, 
+			   int tracenum, stats_t *stats);
+
 /********************
  * Global variables
  *******************/
@@ -92,6 +230,24 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+static int num_workers = 0;  /* number of worker processes (-j) */
+static int pin_workers = 0;  /* if set, pin each worker to one CPU (-p) */
+static int bench_threads = 0;/* max threads in the concurrent benchmark (-T) */
+static int latency = 0;      /* if set, measure per-request latency (-L) */
+static double timer_ovhd = 0;/* cycles taken by a back-to-back counter read */
+static FILE *timeline = NULL;/* CSV file for the heap timeline (-F) */
+static touch_pattern_t touch_pattern = TOUCH_NONE; /* payload accesses (-A) */
+static int touch_write = 0;  /* if set, payload accesses also write (-A) */
+static int cache_model = 0;  /* if set, simulate mm.c's metadata refs (-M) */
+static char *snap_prefix = NULL; /* heap snapshot file name prefix (-D) */
+static int profile_warmup = 0; /* allocations to learn size classes from (-P) */
+static char *profile_prefix = NULL; /* size class profile file name prefix (-P) */
+static volatile char touch_sink; /* keeps payload reads from being elided */
+static int sample_ops = 0;   /* timeline sample interval in requests (-N) */
+
+/* Serializes calls into mm.c, which is not thread-safe */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -124,14 +280,71 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_timeline(trace_t *trace, char *filename);
+static void sample_heap(char *filename, int opnum, int live_bytes);
+static void eval_mm_snapshot(trace_t *trace, int tracenum);
+
+/* Routines that evaluate one complete tracefile, serially or in parallel */
+static void eval_libc_trace(char *tracedir, char *filename, 
+			    int tracenum, stats_t *stats);
+static void eval_mm_trace(char *tracedir, char *filename, 
+			  int tracenum, stats_t *stats);
+static void eval_traces(eval_funct eval, char **tracefiles, 
+			int num_tracefiles, stats_t *stats);
+static void eval_parallel(eval_funct eval, char **tracefiles, 
+			  int num_tracefiles, stats_t *stats);
+static void eval_worker(eval_funct eval, char **tracefiles, int worker,
+			int taskfd, int resultfd);
+
+/* Routines for the multithreaded allocation benchmark */
+static int reset_mm_init(void);
+static void *locked_mm_malloc(size_t size);
+static void locked_mm_free(void *ptr);
+static void *locked_mm_realloc(void *ptr, size_t size);
+static void eval_concurrent(char **tracefiles, int num_tracefiles, 
+			    int producer_consumer);
+static double run_concurrent(mt_run_t *run);
+static double mt_now(void);
+static void *mt_replay_thread(void *vargp);
+static void *mt_handoff_thread(void *vargp);
+
+/* Routines for measuring the latency of individual requests */
+static unsigned long long read_cycles(void);
+static void calibrate_latency(void);
+static void eval_latency(trace_t *trace, engine_t *engine, stats_t *stats);
+
+/* Routines for replaying traces that access their payloads */
+static void eval_touch(trace_t *trace, engine_t *engine, stats_t *stats);
+static void eval_touch_speed(void *ptr);
+static void touch_block(char *p, int size);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
+static void printcachesim(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void write_results(char *file, char **tracefiles, int n, 
+			  stats_t *mm_stats, stats_t *libc_stats,
+			  double perfindex);
+static void write_json_stats(FILE *fp, char **tracefiles, int n,
+			     stats_t *stats);
+static void write_json_string(FILE *fp, char *str);
+static int read_baseline(char *file, baseline_t **base);
+static char *json_field(char *obj, char *end, char *key);
+static int compare_results(char *file, char **tracefiles, int n,
+			   stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
 
+/* The allocators as used by a single thread, for -L and -A */
+static engine_t libc_engine = {"libc", NULL, malloc, free, realloc};
+static engine_t mm_engine = {
+    "mm", reset_mm_init, mm_malloc, mm_free, mm_realloc
+};
+
 /**************
  * Main routine
  **************/
@@ -141,15 +354,22 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 0;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int producer_consumer = 0; /* If set, -T runs the synthetic pattern (-x) */
+    char *results_file = NULL; /* If set, write the results here (-o) */
+    char *baseline_file = NULL;/* If set, compare against it (--compare) */
+    int regressions = 0;       /* number of traces that got worse */
+
+    /* long options, for those that have no single-letter name */
+    static struct option long_opts[] = {
+	{"compare", required_argument, NULL, 'C'},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +378,8 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:hvVgalj:pT:xLF:N:cwo:A:M:D:d:P:", 
+			    long_opts, NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +405,100 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Evaluate the traces with this many worker processes */
+            num_workers = atoi(optarg);
+            if (num_workers < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'p': /* Pin each worker process to its own CPU */
+            pin_workers = 1;
+            break;
+        case 'T': /* Run the concurrent benchmark with up to this many threads */
+            bench_threads = atoi(optarg);
+            if (bench_threads < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'x': /* Concurrent benchmark frees blocks in other threads */
+            producer_consumer = 1;
+            break;
+        case 'L': /* Measure the latency of each request */
+            latency = 1;
+            break;
+        case 'F': /* Write a timeline of the heap to this CSV file */
+            if ((timeline = fopen(optarg, "w")) == NULL)
+		unix_error("ERROR: could not open timeline file");
+            fprintf(timeline, "trace,op,live_bytes,heap_bytes,"
+		    "free_blocks,largest_free,util\n");
+            break;
+        case 'N': /* Sample the heap every this many requests */
+            sample_ops = atoi(optarg);
+            break;
+        case 'c': /* Flush the caches before every timed run */
+            set_fsecs_cache_mode(FSECS_COLD);
+            break;
+        case 'w': /* Warm the caches with an untimed run */
+            set_fsecs_cache_mode(FSECS_WARM);
+            break;
+        case 'A': /* Access the payloads in this pattern between requests */
+	    touch_write = (strstr(optarg, "+w") != NULL);
+	    if (strncmp(optarg, "seq", 3) == 0)
+		touch_pattern = TOUCH_SEQ;
+	    else if (strncmp(optarg, "rand", 4) == 0)
+		touch_pattern = TOUCH_RAND;
+	    else if (strncmp(optarg, "recent", 6) == 0)
+		touch_pattern = TOUCH_RECENT;
+	    else {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'M': /* Simulate mm.c's metadata refs in a cache of s,E,b */
+	    {
+		int s, E, b;
+		if (sscanf(optarg, "%d,%d,%d", &s, &E, &b) != 3 ||
+		    cachesim_init(s, E, b) < 0) {
+		    usage();
+		    exit(1);
+		}
+	    }
+	    cache_model = 1;
+            break;
+        case 'd': /* Check canaries of 1 in n mm blocks, guard large ones */
+	    {
+		int n;
+		unsigned long bytes = 0;
+		if (sscanf(optarg, "%d,%lu", &n, &bytes) < 1 || n < 1) {
+		    usage();
+		    exit(1);
+		}
+		mm_debug(n, (size_t)bytes);
+	    }
+            break;
+        case 'P': /* Learn mm size classes from the first n requests */
+	    {
+		char *comma = strchr(optarg, ',');
+		profile_warmup = atoi(optarg);
+		if (profile_warmup < 1) {
+		    usage();
+		    exit(1);
+		}
+		if (comma != NULL)
+		    profile_prefix = comma + 1;
+	    }
+            break;
+        case 'D': /* Dump a heap snapshot of each trace at its peak */
+            snap_prefix = optarg;
+            break;
+        case 'o': /* Write the results as JSON (or CSV if *.csv) */
+            results_file = optarg;
+            break;
+        case 'C': /* Flag traces that regressed against a JSON baseline */
+            baseline_file = optarg;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -235,8 +550,25 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* The timeline is written one trace at a time, in order */
+    if (timeline != NULL && num_workers > 0) {
+	printf("Ignoring -j: the heap timeline (-F) is recorded serially\n");
+	num_workers = 0;
+    }
+
     /* Initialize the timing package */
     init_fsecs();
+    if (latency)
+	calibrate_latency();
+
+    /*
+     * The concurrent benchmark replaces the usual evaluation
+     */
+    if (bench_threads > 0) {
+	mem_init();
+	eval_concurrent(tracefiles, num_tracefiles, producer_consumer);
+	exit(0);
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -251,25 +583,21 @@ int main(int argc, char **argv)
 	    unix_error("libc_stats calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
+	eval_traces(eval_libc_trace, tracefiles, num_tracefiles, libc_stats);
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
+	    printcounters(num_tracefiles, libc_stats);
+	}
+	if (latency) {
+	    printf("\nLatency for libc malloc:\n");
+	    printlatency(num_tracefiles, libc_stats);
+	}
+	if (touch_pattern != TOUCH_NONE) {
+	    printf("\nPayload accesses for libc malloc:\n");
+	    printtouch(num_tracefiles, libc_stats);
 	}
     }
 
@@ -284,35 +612,39 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
-    /* Initialize the simulated memory system in memlib.c */
+    /* 
+     * Initialize the simulated memory system in memlib.c. In parallel
+     * mode, each forked worker gets its own private copy of this heap.
+     */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    eval_traces(eval_mm_trace, tracefiles, num_tracefiles, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (latency) {
+	printf("Latency for mm malloc:\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (touch_pattern != TOUCH_NONE) {
+	printf("Payload accesses for mm malloc:\n");
+	printtouch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (cache_model) {
+	printf("Simulated cache misses on mm malloc metadata:\n");
+	printcachesim(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (timeline != NULL && fclose(timeline) != 0)
+	unix_error("ERROR: could not write timeline file");
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -357,12 +689,20 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    /* Save the results and check them against the baseline */
+    if (results_file != NULL)
+	write_results(results_file, tracefiles, num_tracefiles, 
+		      mm_stats, libc_stats, perfindex);
+    if (baseline_file != NULL)
+	regressions = compare_results(baseline_file, tracefiles, 
+				      num_tracefiles, mm_stats);
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    exit(regressions > 0);
 }
 
 
@@ -383,6 +723,7 @@ static int add_range(range_t **ranges, char *lo, int size,
 {
     char *hi = lo + size - 1;
     range_t *p;
+    int region;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,11 +736,19 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+    /* The payload must lie within the extent of a single heap region */
+    if ((region = mem_region_of(lo)) < 0 || 
+	(hi > (char *)mem_region_hi(region))) {
+	if (mem_num_regions() == 1)
+	    sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+		    lo, hi, mem_heap_lo(), mem_heap_hi());
+	else if (region < 0)
+	    sprintf(msg, "Payload (%p:%p) lies outside all %d heap regions",
+		    lo, hi, mem_num_regions());
+	else
+	    sprintf(msg, "Payload (%p:%p) runs off the end of heap region "
+		    "%d (%p:%p)", lo, hi, region, mem_region_lo(region), 
+		    mem_region_hi(region));
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -653,7 +1002,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -778,6 +1127,155 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 }
 
 
+/*
+ * eval_mm_timeline - Replay the trace like eval_mm_util, and append a
+ *   sample of the state of the heap to the timeline file whenever the
+ *   heap grows, every sample_ops requests (if -N was given), and once
+ *   at the end. Each sample records the live payload bytes, the heap
+ *   size, and the number of free blocks and the size of the largest
+ *   one, as reported by the mm package's mm_heapstats().
+ */
+static void eval_mm_timeline(trace_t *trace, char *filename)
+{
+    int i;
+    int index;
+    int size, newsize, oldsize;
+    int total_size = 0;
+    size_t heapsize = 0;
+    char *p;
+    char *newp, *oldp;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_timeline");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_alloc */
+	    size = trace->ops[i].size;
+	    if ((p = mm_malloc(size)) == NULL) 
+		app_error("mm_malloc failed in eval_mm_timeline");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    newsize = trace->ops[i].size;
+	    oldsize = trace->block_sizes[index];
+	    oldp = trace->blocks[index];
+	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		app_error("mm_realloc failed in eval_mm_timeline");
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = newsize;
+	    total_size += (newsize - oldsize);
+	    break;
+
+        case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_timeline");
+        }
+
+	if (mem_heapsize() != heapsize || 
+	    (sample_ops > 0 && (i+1) % sample_ops == 0) ||
+	    i == trace->num_ops - 1) {
+	    heapsize = mem_heapsize();
+	    sample_heap(filename, i, total_size);
+	}
+    }
+}
+
+/*
+ * sample_heap - Append one row to the timeline file
+ */
+static void sample_heap(char *filename, int opnum, int live_bytes)
+{
+    size_t free_blocks, largest_free;
+    size_t heapsize = mem_heapsize();
+
+    mm_heapstats(&free_blocks, &largest_free);
+    fprintf(timeline, "%s,%d,%d,%lu,%lu,%lu,%.4f\n", filename, opnum,
+	    live_bytes, (unsigned long)heapsize, (unsigned long)free_blocks, 
+	    (unsigned long)largest_free,
+	    heapsize ? (double)live_bytes / heapsize : 0.0);
+}
+
+/*
+ * eval_mm_snapshot - Replay the trace up to the request after which
+ *   the live payload bytes peak, which is where eval_mm_util measures
+ *   the utilization, and write the mm package's snapshot of the heap
+ *   at that point to <prefix><tracenum>.snap for the mmsnap analyzer
+ */
+static void eval_mm_snapshot(trace_t *trace, int tracenum)
+{
+    int i, index, fd;
+    int total_size = 0, max_total_size = 0, peak = 0;
+    char *p;
+    char filename[MAXLINE];
+
+    /* Find the peak from the trace alone */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total_size += trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size - trace->block_sizes[index];
+	    break;
+	case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (trace->ops[i].type != FREE)
+	    trace->block_sizes[index] = trace->ops[i].size;
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    peak = i;
+	}
+    }
+
+    /* Rebuild the heap as it was at the peak */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_snapshot");
+    for (i = 0;  i <= peak;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_snapshot");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+	    if (p == NULL)
+		app_error("mm_realloc failed in eval_mm_snapshot");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+    }
+
+    sprintf(filename, "%s%d.snap", snap_prefix, tracenum);
+    if ((fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0)
+	unix_error("ERROR: could not open snapshot file");
+    if (mm_snapshot(fd) < 0)
+	unix_error("ERROR: could not write snapshot file");
+    close(fd);
+    if (verbose > 1)
+	printf("Wrote %s (request %d of %d).\n", filename, peak, 
+	       trace->num_ops);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -910,6 +1408,798 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/****************************************************************
+ * The following routines evaluate complete tracefiles, either one
+ * after another or in parallel by a pool of worker processes.
+ ***************************************************************/
+
+/*
+ * eval_libc_trace - Check libc malloc for correctness and measure
+ *     its performance on one tracefile
+ */
+static void eval_libc_trace(char *tracedir, char *filename,
+			    int tracenum, stats_t *stats)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, filename);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking libc malloc for correctness, ");
+    stats->valid = eval_libc_valid(trace, tracenum);
+    if (stats->valid) {
+	speed_params.trace = trace;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(eval_libc_speed, &speed_params);
+	stats->noise = fsecs_noise();
+	fsecs_counters(&stats->perf);
+	if (latency)
+	    eval_latency(trace, &libc_engine, stats);
+	if (touch_pattern != TOUCH_NONE)
+	    eval_touch(trace, &libc_engine, stats);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_trace - Check the mm malloc package for correctness and
+ *     measure its space utilization and performance on one tracefile
+ */
+static void eval_mm_trace(char *tracedir, char *filename,
+			  int tracenum, stats_t *stats)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    char profile[MAXLINE];
+
+    trace = read_trace(tracedir, filename);
+    stats->ops = trace->num_ops;
+    if (profile_warmup > 0) {
+	/* the correctness run learns the classes, unless the file has them */
+	if (profile_prefix != NULL) {
+	    sprintf(profile, "%s%d.prof", profile_prefix, tracenum);
+	    mm_profile(profile_warmup, profile);
+	}
+	else
+	    mm_profile(profile_warmup, NULL);
+    }
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, &ranges);
+	if (timeline != NULL)
+	    eval_mm_timeline(trace, filename);
+	if (snap_prefix != NULL)
+	    eval_mm_snapshot(trace, tracenum);
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	stats->noise = fsecs_noise();
+	fsecs_counters(&stats->perf);
+	if (latency)
+	    eval_latency(trace, &mm_engine, stats);
+	if (touch_pattern != TOUCH_NONE)
+	    eval_touch(trace, &mm_engine, stats);
+	if (cache_model) {
+	    cachesim_start();
+	    eval_mm_speed(&speed_params);
+	    cachesim_stop(&stats->sim);
+	}
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * eval_traces - Evaluate every tracefile, in order or with a pool
+ *     of num_workers processes if -j was given
+ */
+static void eval_traces(eval_funct eval, char **tracefiles,
+			int num_tracefiles, stats_t *stats)
+{
+    int i;
+
+    if (num_workers > 0) {
+	eval_parallel(eval, tracefiles, num_tracefiles, stats);
+	return;
+    }
+    for (i=0; i < num_tracefiles; i++)
+	eval(tracedir, tracefiles[i], i, &stats[i]);
+}
+
+/*
+ * eval_parallel - Fork num_workers processes that pull trace numbers
+ *     off a shared task pipe and send a result_t back for each trace
+ *     over a shared result pipe. Since the allocator under test keeps
+ *     global state, each worker runs it on its own copy of the heap.
+ *     A trace whose worker dies before reporting is marked invalid.
+ */
+static void eval_parallel(eval_funct eval, char **tracefiles,
+			  int num_tracefiles, stats_t *stats)
+{
+    int i, n, w;
+    int taskfd[2], resultfd[2];
+    int *done;
+    pid_t *pids;
+    result_t result;
+    void (*old_sigpipe)(int);
+
+    if (pipe(taskfd) < 0 || pipe(resultfd) < 0)
+	unix_error("pipe failed in eval_parallel");
+    if ((pids = (pid_t *)calloc(num_workers, sizeof(pid_t))) == NULL)
+	unix_error("calloc 1 failed in eval_parallel");
+    if ((done = (int *)calloc(num_tracefiles, sizeof(int))) == NULL)
+	unix_error("calloc 2 failed in eval_parallel");
+
+    /* Don't let the children inherit (and later repeat) buffered output */
+    fflush(stdout);
+    old_sigpipe = signal(SIGPIPE, SIG_IGN);
+
+    for (w = 0; w < num_workers; w++) {
+	if ((pids[w] = fork()) < 0)
+	    unix_error("fork failed in eval_parallel");
+	if (pids[w] == 0) {
+	    close(taskfd[1]);
+	    close(resultfd[0]);
+	    eval_worker(eval, tracefiles, w, taskfd[0], resultfd[1]);
+	    fflush(stdout);
+	    exit(0);
+	}
+    }
+    close(taskfd[0]);
+    close(resultfd[1]);
+
+    /*
+     * Queue up the trace numbers. Each write is smaller than PIPE_BUF,
+     * so it is atomic, and every worker read gets one whole number.
+     */
+    for (i = 0; i < num_tracefiles; i++) {
+	if (write(taskfd[1], &i, sizeof(int)) != sizeof(int))
+	    break; /* all of the workers have died */
+    }
+    close(taskfd[1]);
+
+    /* Collect one result per trace until every worker has exited */
+    while ((n = read(resultfd[0], &result, sizeof(result_t))) != 0) {
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read failed in eval_parallel");
+	}
+	if (n != sizeof(result_t) ||
+	    result.tracenum < 0 || result.tracenum >= num_tracefiles)
+	    app_error("Bogus result record in eval_parallel");
+	stats[result.tracenum] = result.stats;
+	errors += result.errors;
+	done[result.tracenum] = 1;
+    }
+    close(resultfd[0]);
+
+    for (w = 0; w < num_workers; w++)
+	waitpid(pids[w], NULL, 0);
+    signal(SIGPIPE, old_sigpipe);
+
+    for (i = 0; i < num_tracefiles; i++) {
+	if (!done[i]) {
+	    errors++;
+	    printf("ERROR [trace %d]: worker exited before finishing %s\n",
+		   i, tracefiles[i]);
+	    stats[i].valid = 0;
+	}
+    }
+    free(done);
+    free(pids);
+}
+
+/*
+ * eval_worker - Body of a worker process in parallel mode. Evaluates
+ *     traces from taskfd until it is empty and writes a result_t for
+ *     each one to resultfd.
+ */
+static void eval_worker(eval_funct eval, char **tracefiles, int worker,
+			int taskfd, int resultfd)
+{
+    int tracenum, ncpus;
+    int old_errors;
+    result_t result;
+    cpu_set_t cpus;
+
+    if (pin_workers) {
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1)
+	    ncpus = 1;
+	CPU_ZERO(&cpus);
+	CPU_SET(worker % ncpus, &cpus);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) < 0)
+	    fprintf(stderr, "Warning: could not pin worker %d to CPU %d: %s\n",
+		    worker, worker % ncpus, strerror(errno));
+    }
+
+#if USE_PERF
+    /* The inherited counters would count the parent, so open our own */
+    perf_close();
+    perf_open();
+#endif
+
+    while (read(taskfd, &tracenum, sizeof(int)) == sizeof(int)) {
+	memset(&result, 0, sizeof(result_t));
+	result.tracenum = tracenum;
+	old_errors = errors;
+	eval(tracedir, tracefiles[tracenum], tracenum, &result.stats);
+	result.errors = errors - old_errors;
+	fflush(stdout);
+	if (write(resultfd, &result, sizeof(result_t)) != sizeof(result_t))
+	    unix_error("write failed in eval_worker");
+    }
+}
+
+/*******************************************************************
+ * The following routines implement the concurrent benchmark (-T),
+ * which measures how the aggregate throughput of an allocator scales
+ * as more threads use it at once. mm.c keeps global state, so it runs
+ * behind a single global lock; that is the baseline any thread-safe
+ * engine added to the engines[] table has to beat.
+ ******************************************************************/
+
+/*
+ * reset_mm_init - Empty the heap and reinitialize the mm package
+ */
+static int reset_mm_init(void)
+{
+    mem_reset_brk();
+    return mm_init();
+}
+
+/*
+ * locked_mm_xxx - Serialize each call into the mm package
+ */
+static void *locked_mm_malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mm_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void locked_mm_free(void *ptr)
+{
+    pthread_mutex_lock(&mm_lock);
+    mm_free(ptr);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+static void *locked_mm_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mm_lock);
+    p = mm_realloc(ptr, size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+/* The allocators measured by the concurrent benchmark */
+static engine_t engines[] = {
+    {"libc", NULL, malloc, free, realloc},
+    {"mm+lock", reset_mm_init, locked_mm_malloc, locked_mm_free, 
+     locked_mm_realloc},
+};
+
+/*
+ * eval_concurrent - Measure every engine with 1, 2, 4, ... bench_threads
+ *     threads, and print the aggregate throughput and the scaling
+ *     efficiency, i.e., the throughput per thread relative to the
+ *     single-threaded run. In trace mode each thread replays all of the
+ *     tracefiles; in producer/consumer mode each thread hands every
+ *     block it allocates to the next thread, which frees it.
+ */
+static void eval_concurrent(char **tracefiles, int num_tracefiles, 
+			    int producer_consumer)
+{
+    int e, i, n;
+    int num_engines = sizeof(engines) / sizeof(engine_t);
+    double ops_per_thread = 0;
+    double secs, kops, base_kops;
+    mt_run_t run;
+
+    memset(&run, 0, sizeof(mt_run_t));
+    run.producer_consumer = producer_consumer;
+    if (producer_consumer) {
+	ops_per_thread = 2.0 * MT_ALLOCS;
+    }
+    else {
+	run.num_traces = num_tracefiles;
+	if ((run.traces = (trace_t **)calloc(num_tracefiles, 
+					     sizeof(trace_t *))) == NULL)
+	    unix_error("calloc failed in eval_concurrent");
+	for (i = 0; i < num_tracefiles; i++) {
+	    run.traces[i] = read_trace(tracedir, tracefiles[i]);
+	    ops_per_thread += run.traces[i]->num_ops;
+	}
+    }
+
+    printf("\nConcurrent benchmark (%s):\n", producer_consumer ? 
+	   "producer/consumer" : "trace replay");
+    printf("%8s%8s%10s%10s%8s%9s\n", 
+	   "engine", "threads", "ops", "secs", "Kops", "scaling");
+    for (e = 0; e < num_engines; e++) {
+	run.engine = &engines[e];
+	base_kops = 0;
+	for (n = 1; n <= bench_threads; n = (n*2 > bench_threads && 
+					     n < bench_threads) ? 
+		 bench_threads : n*2) {
+	    run.nthreads = n;
+	    secs = run_concurrent(&run);
+	    if (run.failed) {
+		printf("%8s%8d%10s%10s%8s%9s  (allocation failed)\n",
+		       run.engine->name, n, "-", "-", "-", "-");
+		break;
+	    }
+	    kops = (n * ops_per_thread / 1e3) / secs;
+	    if (n == 1)
+		base_kops = kops;
+	    printf("%8s%8d%10.0f%10.6f%8.0f%8.0f%%\n", 
+		   run.engine->name, n, n * ops_per_thread, secs, kops,
+		   100.0 * kops / (n * base_kops));
+	}
+    }
+
+    for (i = 0; i < run.num_traces; i++)
+	free_trace(run.traces[i]);
+    free(run.traces);
+}
+
+/*
+ * mt_now - Return the current time in seconds from a monotonic clock
+ */
+static double mt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1E-9*ts.tv_nsec;
+}
+
+/*
+ * run_concurrent - Run run->nthreads threads against run->engine 
+ *     MT_REPS times and return the shortest wall-clock time, measured
+ *     from the moment the first thread starts working until the last
+ *     one is done. Sets run->failed if an allocation request failed.
+ */
+static double run_concurrent(mt_run_t *run)
+{
+    int i, rep, max_ids = 0;
+    double start, end, best = DBL_MAX;
+    pthread_t *tids;
+    mt_thread_t *args;
+
+    if ((tids = (pthread_t *)calloc(run->nthreads, sizeof(pthread_t))) == NULL ||
+	(args = (mt_thread_t *)calloc(run->nthreads, sizeof(mt_thread_t))) == NULL ||
+	(run->queues = (mt_queue_t *)calloc(run->nthreads, 
+					    sizeof(mt_queue_t))) == NULL)
+	unix_error("calloc failed in run_concurrent");
+    for (i = 0; i < run->num_traces; i++)
+	max_ids = (run->traces[i]->num_ids > max_ids) ? 
+	    run->traces[i]->num_ids : max_ids;
+    for (i = 0; i < run->nthreads; i++) {
+	args[i].run = run;
+	args[i].id = i;
+	if (max_ids > 0 &&
+	    (args[i].blocks = (char **)calloc(max_ids, sizeof(char *))) == NULL)
+	    unix_error("calloc failed in run_concurrent");
+	pthread_mutex_init(&run->queues[i].lock, NULL);
+    }
+
+    run->failed = 0;
+    for (rep = 0; rep < MT_REPS && !run->failed; rep++) {
+	if (run->engine->init && run->engine->init() < 0)
+	    app_error("engine init failed in run_concurrent");
+	run->freed = 0;
+	pthread_barrier_init(&run->start, NULL, run->nthreads + 1);
+	for (i = 0; i < run->nthreads; i++) {
+	    if (pthread_create(&tids[i], NULL, run->producer_consumer ? 
+			       mt_handoff_thread : mt_replay_thread, 
+			       &args[i]) != 0)
+		app_error("pthread_create failed in run_concurrent");
+	}
+	pthread_barrier_wait(&run->start);
+	for (i = 0; i < run->nthreads; i++)
+	    pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&run->start);
+
+	start = DBL_MAX;
+	end = 0;
+	for (i = 0; i < run->nthreads; i++) {
+	    start = (args[i].start < start) ? args[i].start : start;
+	    end = (args[i].end > end) ? args[i].end : end;
+	}
+	best = (end - start < best) ? end - start : best;
+    }
+
+    for (i = 0; i < run->nthreads; i++) {
+	pthread_mutex_destroy(&run->queues[i].lock);
+	free(args[i].blocks);
+    }
+    free(run->queues);
+    run->queues = NULL;
+    free(args);
+    free(tids);
+    return best;
+}
+
+/*
+ * mt_replay_thread - Replay every tracefile once, starting at a 
+ *     different trace in each thread so they don't run in lockstep.
+ *     Blocks still allocated at the end of a trace are freed.
+ */
+static void *mt_replay_thread(void *vargp)
+{
+    mt_thread_t *arg = (mt_thread_t *)vargp;
+    mt_run_t *run = arg->run;
+    engine_t *eng = run->engine;
+    trace_t *trace;
+    traceop_t *op;
+    char *p;
+    int i, j;
+
+    pthread_barrier_wait(&run->start);
+    arg->start = mt_now();
+    for (j = 0; j < run->num_traces; j++) {
+	trace = run->traces[(arg->id + j) % run->num_traces];
+	memset(arg->blocks, 0, trace->num_ids * sizeof(char *));
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    switch (op->type) {
+	    case ALLOC:
+		if ((p = eng->malloc(op->size)) == NULL)
+		    goto failed;
+		arg->blocks[op->index] = p;
+		break;
+	    case REALLOC:
+		if ((p = eng->realloc(arg->blocks[op->index], op->size)) == NULL)
+		    goto failed;
+		arg->blocks[op->index] = p;
+		break;
+	    case FREE:
+		eng->free(arg->blocks[op->index]);
+		arg->blocks[op->index] = NULL;
+		break;
+	    }
+	}
+	for (i = 0; i < trace->num_ids; i++)
+	    if (arg->blocks[i] != NULL)
+		eng->free(arg->blocks[i]);
+    }
+    arg->end = mt_now();
+    return NULL;
+
+ failed:
+    run->failed = 1;
+    arg->end = mt_now();
+    return NULL;
+}
+
+/*
+ * mt_handoff_thread - Allocate MT_ALLOCS blocks of random size and push
+ *     each onto the inbox of the next thread, which frees it. A block
+ *     that doesn't fit in a full inbox is freed locally instead. The
+ *     thread keeps draining its own inbox until every block allocated
+ *     by every thread has been freed.
+ */
+static void *mt_handoff_thread(void *vargp)
+{
+    mt_thread_t *arg = (mt_thread_t *)vargp;
+    mt_run_t *run = arg->run;
+    engine_t *eng = run->engine;
+    mt_queue_t *inbox = &run->queues[arg->id];
+    mt_queue_t *next = &run->queues[(arg->id + 1) % run->nthreads];
+    long total = (long)MT_ALLOCS * run->nthreads;
+    unsigned int seed = arg->id + 1;
+    void *batch[MT_QUEUE];
+    char *p;
+    int i, j, n, pushed;
+
+    pthread_barrier_wait(&run->start);
+    arg->start = mt_now();
+    i = 0;
+    while (i < MT_ALLOCS || run->freed < total) {
+	if (i < MT_ALLOCS) {
+	    if ((p = eng->malloc(1 + rand_r(&seed) % MT_MAXSIZE)) == NULL) {
+		/* Give up, but still help free the blocks already handed off */
+		run->failed = 1;
+		__sync_fetch_and_add(&run->freed, MT_ALLOCS - i);
+		i = MT_ALLOCS;
+		continue;
+	    }
+	    *p = (char)i; /* touch the block like a real producer */
+	    i++;
+
+	    pthread_mutex_lock(&next->lock);
+	    if ((pushed = (next->count < MT_QUEUE))) {
+		next->slots[(next->head + next->count) % MT_QUEUE] = p;
+		next->count++;
+	    }
+	    pthread_mutex_unlock(&next->lock);
+	    if (!pushed) {
+		eng->free(p);
+		__sync_fetch_and_add(&run->freed, 1);
+	    }
+	}
+	else {
+	    sched_yield(); /* wait for the other producers */
+	}
+
+	/* Free whatever the previous thread has handed to us */
+	pthread_mutex_lock(&inbox->lock);
+	for (n = 0; inbox->count > 0; n++) {
+	    batch[n] = inbox->slots[inbox->head];
+	    inbox->head = (inbox->head + 1) % MT_QUEUE;
+	    inbox->count--;
+	}
+	pthread_mutex_unlock(&inbox->lock);
+	for (j = 0; j < n; j++)
+	    eng->free(batch[j]);
+	if (n > 0)
+	    __sync_fetch_and_add(&run->freed, n);
+    }
+    arg->end = mt_now();
+    return NULL;
+}
+
+/*****************************************************************
+ * The following routines implement latency mode (-L), which times
+ * every request with the cycle counter instead of timing the trace
+ * as a whole, so that the tail of the distribution is visible.
+ ****************************************************************/
+
+/*
+ * read_cycles - Return the current value of the cycle counter
+ */
+static unsigned long long read_cycles(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/*
+ * calibrate_latency - Measure the smallest number of cycles between
+ *     two back-to-back counter reads. This is subtracted from every
+ *     measured request.
+ */
+static void calibrate_latency(void)
+{
+    int i;
+    unsigned long long t0, t1, best = ~0ULL;
+
+    for (i = 0; i < LAT_CALIBRATE; i++) {
+	t0 = read_cycles();
+	t1 = read_cycles();
+	if (t1 - t0 < best)
+	    best = t1 - t0;
+    }
+    timer_ovhd = (double)best;
+    if (verbose)
+	printf("Timer overhead is %.0f cycles.\n", timer_ovhd);
+}
+
+/*
+ * eval_latency - Replay a trace LAT_PASSES times, timing every request,
+ *     and record the latency percentiles of each request type. 
+ */
+static void eval_latency(trace_t *trace, engine_t *engine, stats_t *stats)
+{
+    int i, pass, index, type;
+    char *p;
+    unsigned long long t0, t1, ovhd = (unsigned long long)timer_ovhd;
+    static hist_t hist[3]; /* too large for the stack */
+
+    for (type = 0; type < 3; type++)
+	hist_init(&hist[type]);
+
+    for (pass = 0; pass < LAT_PASSES; pass++) {
+	if (engine->init && engine->init() < 0)
+	    app_error("init failed in eval_latency");
+	for (i = 0; i < trace->num_ops; i++) {
+	    index = trace->ops[i].index;
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		t0 = read_cycles();
+		p = engine->malloc(trace->ops[i].size);
+		t1 = read_cycles();
+		if (p == NULL)
+		    app_error("malloc failed in eval_latency");
+		trace->blocks[index] = p;
+		break;
+	    case REALLOC:
+		t0 = read_cycles();
+		p = engine->realloc(trace->blocks[index], trace->ops[i].size);
+		t1 = read_cycles();
+		if (p == NULL)
+		    app_error("realloc failed in eval_latency");
+		trace->blocks[index] = p;
+		break;
+	    case FREE:
+		t0 = read_cycles();
+		engine->free(trace->blocks[index]);
+		t1 = read_cycles();
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_latency");
+		return;
+	    }
+	    hist_add(&hist[trace->ops[i].type], 
+		     (t1 - t0 > ovhd) ? t1 - t0 - ovhd : 0);
+	}
+    }
+
+    for (type = 0; type < 3; type++) {
+	stats->lat[type].count = hist[type].count;
+	stats->lat[type].p50 = hist_percentile(&hist[type], 50.0);
+	stats->lat[type].p99 = hist_percentile(&hist[type], 99.0);
+	stats->lat[type].p999 = hist_percentile(&hist[type], 99.9);
+	stats->lat[type].max = hist[type].max;
+    }
+}
+
+/*****************************************************************
+ * The following routines implement payload access mode (-A). The
+ * usual speed test never touches a payload, so it cannot show how
+ * block placement affects the cache behavior of the program that
+ * uses the allocator. Here every block is written when allocated,
+ * and TOUCH_BLOCKS live blocks are accessed after every request.
+ ****************************************************************/
+
+/*
+ * eval_touch - Time a replay of the trace by engine that also
+ *     accesses the payloads, and record its hardware counters
+ */
+static void eval_touch(trace_t *trace, engine_t *engine, stats_t *stats)
+{
+    touch_t params;
+
+    /* Allocated here so that they do not disturb a libc heap under test */
+    params.trace = trace;
+    params.engine = engine;
+    params.live = (int *)calloc(trace->num_ids, sizeof(int));
+    params.pos = (int *)calloc(trace->num_ids, sizeof(int));
+    params.sizes = (int *)calloc(trace->num_ids, sizeof(int));
+    params.older = (int *)calloc(trace->num_ids, sizeof(int));
+    params.newer = (int *)calloc(trace->num_ids, sizeof(int));
+    if (!params.live || !params.pos || !params.sizes || 
+	!params.older || !params.newer)
+	unix_error("calloc failed in eval_touch");
+
+    stats->touch_secs = fsecs(eval_touch_speed, &params);
+    fsecs_counters(&stats->touch_perf);
+
+    free(params.live);
+    free(params.pos);
+    free(params.sizes);
+    free(params.older);
+    free(params.newer);
+}
+
+/*
+ * eval_touch_speed - This is the function that is used by fsecs()
+ *    to measure a replay of the trace that accesses the payloads
+ */
+static void eval_touch_speed(void *ptr)
+{
+    touch_t *params = (touch_t *)ptr;
+    trace_t *trace = params->trace;
+    engine_t *engine = params->engine;
+    int *live = params->live, *pos = params->pos, *sizes = params->sizes;
+    int *older = params->older, *newer = params->newer;
+    int i, k, id, index, size, nlive = 0, next = 0, newest = -1;
+    unsigned int seed = 1;
+    char *p;
+
+    if (engine->init && engine->init() < 0)
+	app_error("init failed in eval_touch_speed");
+    for (i = 0; i < trace->num_ids; i++)
+	pos[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = engine->malloc(size)) == NULL)
+		app_error("malloc failed in eval_touch_speed");
+	    memset(p, index, size);
+	    trace->blocks[index] = p;
+	    sizes[index] = size;
+	    pos[index] = nlive;
+	    live[nlive++] = index;
+	    older[index] = newest;
+	    newer[index] = -1;
+	    if (newest >= 0)
+		newer[newest] = index;
+	    newest = index;
+	    break;
+	case REALLOC:
+	    if ((p = engine->realloc(trace->blocks[index], size)) == NULL)
+		app_error("realloc failed in eval_touch_speed");
+	    if (size > sizes[index])
+		memset(p + sizes[index], index, size - sizes[index]);
+	    trace->blocks[index] = p;
+	    sizes[index] = size;
+	    break;
+	case FREE:
+	    /* move the last live block into the hole */
+	    id = live[--nlive];
+	    live[pos[index]] = id;
+	    pos[id] = pos[index];
+	    pos[index] = -1;
+	    /* and unlink it from the allocation order */
+	    if (older[index] >= 0)
+		newer[older[index]] = newer[index];
+	    if (newer[index] >= 0)
+		older[newer[index]] = older[index];
+	    else
+		newest = older[index];
+	    engine->free(trace->blocks[index]);
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_touch_speed");
+	}
+
+	id = -1;
+	for (k = 0; k < TOUCH_BLOCKS && nlive > 0; k++) {
+	    switch (touch_pattern) {
+	    case TOUCH_SEQ:
+		if (next >= nlive)
+		    next = 0;
+		id = live[next++];
+		break;
+	    case TOUCH_RAND:
+		seed = seed * 1103515245 + 12345;
+		id = live[(seed >> 16) % nlive];
+		break;
+	    default: /* TOUCH_RECENT: newest first, again once all are done */
+		id = (id >= 0 && older[id] >= 0) ? older[id] : newest;
+		break;
+	    }
+	    touch_block(trace->blocks[id], sizes[id]);
+	}
+    }
+
+    /* Leave the heap empty for the next run */
+    while (nlive > 0) {
+	id = live[--nlive];
+	engine->free(trace->blocks[id]);
+    }
+}
+
+/*
+ * touch_block - Read (and, with +w, write) one byte in every
+ *     TOUCH_STRIDE bytes of a payload
+ */
+static void touch_block(char *p, int size)
+{
+    int j;
+    char sum = 0;
+
+    for (j = 0; j < size; j += TOUCH_STRIDE) {
+	sum += p[j];
+	if (touch_write)
+	    p[j] = sum;
+    }
+    touch_sink = sum;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -972,6 +2262,405 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints the per-request latency percentiles (in cycles)
+ *     of every request type for each trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, type;
+    static int order[3] = {ALLOC, FREE, REALLOC};
+    static char *names[3] = {"malloc", "free", "realloc"};
+
+    printf("%5s", "");
+    for (type = 0; type < 3; type++)
+	printf(" %-27s", names[type]);
+    printf("\n%5s", "trace");
+    for (type = 0; type < 3; type++)
+	printf(" %6s%6s%7s%8s", "p50", "p99", "p99.9", "max");
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (type = 0; type < 3; type++) {
+	    lat_t *lat = &stats[i].lat[order[type]];
+	    if (stats[i].valid && lat->count > 0)
+		printf(" %6.0f%6.0f%7.0f%8.0f", 
+		       lat->p50, lat->p99, lat->p999, lat->max);
+	    else
+		printf(" %6s%6s%7s%8s", "-", "-", "-", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printtouch - prints the time of each trace in payload access mode,
+ *     how much slower that is than the plain replay, and the cache
+ *     and TLB misses per request if the timing package has them
+ */
+static void printtouch(int n, stats_t *stats)
+{
+    static int counters[3] = {PERF_L1D_MISSES, PERF_LLC_MISSES, 
+			      PERF_DTLB_MISSES};
+    int i, c;
+
+    printf("%5s%10s%6s%8s", "trace", "secs", "Kops", "slower");
+    for (c = 0; c < 3; c++)
+	printf("%12s", perf_name(counters[c]));
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%6s%8s\n", i, "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%13.6f%6.0f%7.2fx", i, stats[i].touch_secs, 
+	       (stats[i].ops/1e3)/stats[i].touch_secs,
+	       stats[i].touch_secs/stats[i].secs);
+	for (c = 0; c < 3; c++) {
+	    if (stats[i].touch_perf.valid[counters[c]])
+		printf("%12.2f", stats[i].touch_perf.val[counters[c]] / 
+		       stats[i].ops);
+	    else
+		printf("%12s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printcachesim - prints the references that mm.c made to its own
+ *     metadata in one replay of each trace, and how many of them
+ *     missed in the simulated cache
+ */
+static void printcachesim(int n, stats_t *stats)
+{
+    int i;
+    double refs = 0;
+
+    for (i = 0; i < n; i++)
+	if (stats[i].valid)
+	    refs += stats[i].sim.refs;
+    if (refs == 0) {
+	printf("No references recorded: mm.c is not instrumented "
+	       "(make mdriver-cachesim)\n");
+	return;
+    }
+
+    printf("%5s%9s%10s%10s%8s\n", "trace", "refs/op", "misses/op", 
+	   "evicts/op", "miss%");
+    for (i = 0; i < n; i++) {
+	cachesim_counts_t *sim = &stats[i].sim;
+	if (stats[i].valid && sim->refs > 0)
+	    printf("%2d%12.2f%10.3f%10.3f%7.2f%%\n", i, 
+		   sim->refs / stats[i].ops, sim->misses / stats[i].ops, 
+		   sim->evictions / stats[i].ops,
+		   100.0 * sim->misses / (sim->hits + sim->misses));
+	else
+	    printf("%2d%12s%10s%10s%8s\n", i, "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printcounters - prints the hardware counters for one run of each
+ *     trace, if the timing package could read any of them
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, c, any = 0;
+
+    for (i = 0; i < n; i++)
+	for (c = 0; c < PERF_NCOUNTERS; c++)
+	    any |= stats[i].valid && stats[i].perf.valid[c];
+    if (!any)
+	return;
+
+    printf("\nHardware counters per run:\n");
+    printf("%5s", "trace");
+    for (c = 0; c < PERF_NCOUNTERS; c++)
+	printf("%11s", perf_name(c));
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+	    if (stats[i].valid && stats[i].perf.valid[c])
+		printf("%11.0f", stats[i].perf.val[c]);
+	    else
+		printf("%11s", "-");
+	}
+	if (stats[i].valid && stats[i].perf.valid[PERF_CYCLES] && 
+	    stats[i].perf.valid[PERF_INSTRUCTIONS] &&
+	    stats[i].perf.val[PERF_CYCLES] > 0)
+	    printf("%6.2f\n", stats[i].perf.val[PERF_INSTRUCTIONS] / 
+		   stats[i].perf.val[PERF_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * write_results - Write the results for each trace, and the perf index,
+ *     to a file for other programs. The file is CSV if its name ends in
+ *     ".csv" and JSON otherwise; the CSV form repeats the perf index in
+ *     a column of its own on every row. Only the JSON form can be read
+ *     back by --compare. libc_stats is NULL unless libc malloc was run
+ *     (-l).
+ */
+static void write_results(char *file, char **tracefiles, int n, 
+			  stats_t *mm_stats, stats_t *libc_stats,
+			  double perfindex)
+{
+    FILE *fp;
+    size_t len = strlen(file);
+    int i, j;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	unix_error("ERROR: could not open results file");
+
+    if (len > 4 && strcmp(file + len - 4, ".csv") == 0) {
+	fprintf(fp, "allocator,trace,file,valid,ops,secs,util,kops,noise,"
+		"perfindex\n");
+	for (j = 0; j < 2; j++) {
+	    stats_t *stats = (j == 0) ? mm_stats : libc_stats;
+	    if (stats == NULL)
+		continue;
+	    for (i = 0; i < n; i++) {
+		fprintf(fp, "%s,%d,%s,%d,%.0f,", j == 0 ? "mm" : "libc",
+			i, tracefiles[i], stats[i].valid, stats[i].ops);
+		if (stats[i].valid)
+		    fprintf(fp, "%.9f,%.4f,%.1f,%.4f,", stats[i].secs, 
+			    stats[i].util, (stats[i].ops/1e3)/stats[i].secs,
+			    stats[i].noise);
+		else
+		    fprintf(fp, ",,,,");
+		fprintf(fp, "%.1f\n", perfindex);
+	    }
+	}
+    }
+    else {
+	fprintf(fp, "{\n  \"perfindex\": %.1f,\n  \"errors\": %d,\n", 
+		perfindex, errors);
+	fprintf(fp, "  \"mm\": ");
+	write_json_stats(fp, tracefiles, n, mm_stats);
+	if (libc_stats != NULL) {
+	    fprintf(fp, ",\n  \"libc\": ");
+	    write_json_stats(fp, tracefiles, n, libc_stats);
+	}
+	fprintf(fp, "\n}\n");
+    }
+
+    if (fclose(fp) != 0)
+	unix_error("ERROR: could not write results file");
+}
+
+/*
+ * write_json_stats - Write the per-trace and total results for one 
+ *     malloc package as a JSON object
+ */
+static void write_json_stats(FILE *fp, char **tracefiles, int n,
+			     stats_t *stats)
+{
+    double secs = 0, ops = 0, util = 0;
+    int i;
+
+    fprintf(fp, "{\n    \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "      {\"trace\": %d, \"file\": ", i);
+	write_json_string(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s, \"ops\": %.0f", 
+		stats[i].valid ? "true" : "false", stats[i].ops);
+	if (stats[i].valid) {
+	    fprintf(fp, ", \"secs\": %.9f, \"util\": %.4f, \"kops\": %.1f, "
+		    "\"noise\": %.4f", stats[i].secs, stats[i].util,
+		    (stats[i].ops/1e3)/stats[i].secs, stats[i].noise);
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+	fprintf(fp, "}%s\n", i < n-1 ? "," : "");
+    }
+    fprintf(fp, "    ],\n");
+    fprintf(fp, "    \"total\": {\"ops\": %.0f, \"secs\": %.9f, "
+	    "\"util\": %.4f, \"kops\": %.1f}\n  }", 
+	    ops, secs, util/n, secs > 0 ? (ops/1e3)/secs : 0);
+}
+
+/*
+ * write_json_string - Write str as a quoted JSON string
+ */
+static void write_json_string(FILE *fp, char *str)
+{
+    putc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    putc('\\', fp);
+	putc(*str, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * read_baseline - Read the mm results from a JSON file written by -o
+ *     into a new array in *base, and return the number of traces. The
+ *     reader only knows the layout that write_results produces, but it
+ *     does not care about white space.
+ */
+static int read_baseline(char *file, baseline_t **base)
+{
+    FILE *fp;
+    char *buf, *p, *end, *val;
+    long len;
+    int i, n = 0, max = 0;
+
+    if ((fp = fopen(file, "r")) == NULL)
+	unix_error("ERROR: could not open baseline file");
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((buf = malloc(len + 1)) == NULL)
+	unix_error("ERROR: malloc failed in read_baseline");
+    if (fread(buf, 1, len, fp) != (size_t)len)
+	unix_error("ERROR: could not read baseline file");
+    buf[len] = '\0';
+    fclose(fp);
+
+    /* The trace objects are the only braces inside the "mm" traces list */
+    *base = NULL;
+    if ((p = strstr(buf, "\"mm\"")) == NULL || 
+	(p = strstr(p, "\"traces\"")) == NULL ||
+	(p = strchr(p, '[')) == NULL)
+	app_error("ERROR: no mm results in the baseline file");
+    while ((p = strpbrk(p, "{]")) != NULL && *p == '{') {
+	if ((end = strchr(p, '}')) == NULL)
+	    break;
+	if (n == max) {
+	    max = max ? 2*max : 16;
+	    if ((*base = realloc(*base, max * sizeof(baseline_t))) == NULL)
+		unix_error("ERROR: realloc failed in read_baseline");
+	}
+	memset(&(*base)[n], 0, sizeof(baseline_t));
+	if ((val = json_field(p, end, "file")) != NULL && *val == '"') {
+	    for (i = 0, val++; *val != '"' && i < MAXLINE-1; val++) {
+		if (*val == '\\')
+		    val++;
+		(*base)[n].file[i++] = *val;
+	    }
+	}
+	if ((val = json_field(p, end, "valid")) != NULL)
+	    (*base)[n].valid = (strncmp(val, "true", 4) == 0);
+	if ((val = json_field(p, end, "util")) != NULL)
+	    (*base)[n].util = strtod(val, NULL);
+	if ((val = json_field(p, end, "kops")) != NULL)
+	    (*base)[n].kops = strtod(val, NULL);
+	if ((val = json_field(p, end, "noise")) != NULL)
+	    (*base)[n].noise = strtod(val, NULL);
+	n++;
+	p = end + 1;
+    }
+    free(buf);
+    return n;
+}
+
+/*
+ * json_field - Return a pointer to the value of "key" in the JSON
+ *     object between obj and end, or NULL if the object has no such key
+ */
+static char *json_field(char *obj, char *end, char *key)
+{
+    size_t len = strlen(key);
+    char *p;
+
+    for (p = obj; p < end && (p = strchr(p, '"')) != NULL && p < end; p++) {
+	if (strncmp(p + 1, key, len) == 0 && p[len + 1] == '"') {
+	    p += len + 2;
+	    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || 
+			       *p == '\r' || *p == ':'))
+		p++;
+	    return p;
+	}
+	/* skip over the rest of this string */
+	for (p++; p < end && *p != '"'; p++)
+	    if (*p == '\\')
+		p++;
+    }
+    return NULL;
+}
+
+/*
+ * compare_results - Compare the mm results against a baseline written
+ *     by -o, matching the traces by file name. A trace regresses if it
+ *     now fails, if its utilization dropped, or if its throughput
+ *     dropped by more than the timing noise of the two runs allows.
+ *     A baseline without a throughput (zero, or a field that could not
+ *     be read) only has its utilization checked. Prints a table and
+ *     returns the number of regressed traces.
+ */
+static int compare_results(char *file, char **tracefiles, int n,
+			   stats_t *stats)
+{
+    baseline_t *base;
+    int i, j, nbase, regressions = 0;
+    double kops, tol, change;
+    char *status;
+
+    nbase = read_baseline(file, &base);
+
+    printf("\nComparison with %s:\n", file);
+    printf("%5s%10s%10s%8s%7s%6s%6s  %s\n", "trace", "base Kops", "Kops",
+	   "change", "noise", "util", "was", "status");
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < nbase; j++)
+	    if (strcmp(base[j].file, tracefiles[i]) == 0)
+		break;
+	if (j == nbase) {
+	    printf("%2d%51s  %s\n", i, "", "not in baseline");
+	    continue;
+	}
+	if (!base[j].valid) {
+	    printf("%2d%51s  %s\n", i, "", "failed in baseline");
+	    continue;
+	}
+	if (!stats[i].valid) {
+	    printf("%2d%51s  %s\n", i, "", "FAILED");
+	    regressions++;
+	    continue;
+	}
+
+	kops = (stats[i].ops/1e3)/stats[i].secs;
+	if (!(base[j].kops > 0)) {
+	    status = "no baseline throughput";
+	    if (stats[i].util < base[j].util - CMP_UTIL_EPS) {
+		status = "WORSE UTIL";
+		regressions++;
+	    }
+	    printf("%2d%13s%10.0f%8s%7s%5.0f%%%5.0f%%  %s\n", i, "-", kops,
+		   "-", "-", stats[i].util*100.0, base[j].util*100.0, status);
+	    continue;
+	}
+	change = (kops - base[j].kops) / base[j].kops;
+	tol = CMP_NOISE_SCALE * (base[j].noise + stats[i].noise);
+	if (tol < CMP_MIN_NOISE)
+	    tol = CMP_MIN_NOISE;
+
+	status = "ok";
+	if (stats[i].util < base[j].util - CMP_UTIL_EPS)
+	    status = "WORSE UTIL";
+	else if (change < -tol)
+	    status = "SLOWER";
+	if (strcmp(status, "ok") != 0)
+	    regressions++;
+	printf("%2d%13.0f%10.0f%+7.1f%%%6.1f%%%5.0f%%%5.0f%%  %s\n", i, 
+	       base[j].kops, kops, change*100.0, tol*100.0, 
+	       stats[i].util*100.0, base[j].util*100.0, status);
+    }
+    if (regressions > 0)
+	printf("%d trace(s) regressed\n", regressions);
+    else
+	printf("No regressions\n");
+
+    free(base);
+    return regressions;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2693,40 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpxLcw] [-f <file>] [-t <dir>] [-j <n>] [-T <n>]\n"
+	    "               [-F <file> [-N <n>]] [-A <pat>] [-M <s,E,b>] [-D <pfx>]\n"
+	    "               [-d <n>[,<bytes>]] [-P <n>[,<pfx>]] [-o <file>]\n"
+	    "               [--compare <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <pat>   Also time the trace while accessing payloads:\n"
+	    "\t           seq, rand or recent (add +w to write as well).\n");
+    fprintf(stderr, "\t-c         Time each run with cold caches.\n");
+    fprintf(stderr, "\t--compare <file>\n"
+	    "\t           Exit 1 if a trace is worse than in the -o JSON <file>.\n");
+    fprintf(stderr, "\t-d <n>[,<bytes>]\n"
+	    "\t           Canary-check 1 in <n> mm blocks; guard those of at\n"
+	    "\t           least <bytes> with a page.\n");
+    fprintf(stderr, "\t-D <pfx>   Write a heap snapshot at each trace's peak to <pfx><n>.snap.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <file>  Write a CSV timeline of the heap to <file>.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces with <n> worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Report per-request latency percentiles.\n");
+    fprintf(stderr, "\t-M <s,E,b> Count mm.c metadata misses in a simulated cache\n"
+	    "\t           (needs make mdriver-cachesim), e.g. 6,8,6.\n");
+    fprintf(stderr, "\t-N <n>     Also sample the timeline every <n> requests.\n");
+    fprintf(stderr, "\t-o <file>  Write the results to <file> as JSON (CSV if *.csv).\n");
+    fprintf(stderr, "\t-p         Pin each worker process to its own CPU.\n");
+    fprintf(stderr, "\t-P <n>[,<pfx>]\n"
+	    "\t           Learn mm size classes from the first <n> requests, or\n"
+	    "\t           load them from <pfx><trace>.prof (saved if missing).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Run the concurrent benchmark with up to <n> threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w         Time runs with warm caches.\n");
+    fprintf(stderr, "\t-x         Free blocks in other threads with -T.\n");
 }
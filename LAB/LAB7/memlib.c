@@ -2,6 +2,14 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The memory system is a set of independent regions, each with its own
+ * brk pointer. Region 0 is the main heap, which mem_sbrk extends and
+ * mem_heap_lo/mem_heap_hi describe. Allocators that manage several
+ * non-contiguous arenas can create more with mem_region_create.
+ *
+ * The regions are mmap'd, so they are page-aligned, and mem_guard can
+ * protect pages inside them to catch stray accesses.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,24 +22,28 @@
 #include "memlib.h"
 #include "config.h"
 
+/* One region of the simulated memory */
+typedef struct {
+    char *start_brk;  /* points to first byte of the region */
+    char *brk;        /* points to last byte of the region */
+    char *max_addr;   /* largest legal address in the region */
+} region_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static region_t regions[MAX_REGIONS]; /* regions[0] is the main heap */
+static int num_regions = 0;           /* number of regions in use */
+static int num_guards = 0;            /* pages protected by mem_guard */
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    num_regions = 0;
+    if (mem_region_create(MAX_HEAP) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,15 +51,35 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    for (i = 0; i < num_regions; i++)
+	munmap(regions[i].start_brk, 
+	       regions[i].max_addr - regions[i].start_brk);
+    num_regions = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    release every region other than the main heap, and lift any
+ *    protection left by mem_guard, so that the next mm_init starts 
+ *    from scratch
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    region_t *r;
+
+    while (num_regions > 1) {
+	r = &regions[--num_regions];
+	munmap(r->start_brk, r->max_addr - r->start_brk);
+    }
+    r = &regions[0];
+    if (num_guards > 0) {
+	mprotect(r->start_brk, r->max_addr - r->start_brk, 
+		 PROT_READ | PROT_WRITE);
+	num_guards = 0;
+    }
+    r->brk = r->start_brk;
 }
 
 /* 
@@ -57,15 +89,7 @@ void mem_reset_brk()
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(0, incr);
 }
 
 /*
@@ -73,7 +97,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(0);
 }
 
 /* 
@@ -81,15 +105,21 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(0);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over every
+ *    region, so that it is the whole footprint of the allocator
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < num_regions; i++)
+	size += mem_region_size(i);
+    return size;
 }
 
 /*
@@ -99,3 +129,116 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_region_create - reserve a new, empty region that can grow to
+ *    maxsize bytes. Returns its number, or -1 if there are already
+ *    MAX_REGIONS regions or the storage cannot be allocated. The
+ *    region lasts until the next mem_reset_brk.
+ */
+int mem_region_create(size_t maxsize)
+{
+    region_t *r;
+
+    if (num_regions == MAX_REGIONS) {
+	errno = ENOMEM;
+	return -1;
+    }
+    r = &regions[num_regions];
+
+    /* map the storage we will use to model the available VM */
+    r->start_brk = (char *)mmap(NULL, maxsize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->start_brk == MAP_FAILED)
+	return -1;
+    r->max_addr = r->start_brk + maxsize;  /* max legal address */
+    r->brk = r->start_brk;                 /* region is empty initially */
+    return num_regions++;
+}
+
+/*
+ * mem_region_sbrk - extend a region by incr bytes and return the start
+ *    address of the new area, as mem_sbrk does for the main heap
+ */
+void *mem_region_sbrk(int region, int incr)
+{
+    region_t *r;
+    char *old_brk;
+
+    assert(region >= 0 && region < num_regions);
+    r = &regions[region];
+    old_brk = r->brk;
+    if ( (incr < 0) || ((r->brk + incr) > r->max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    r->brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(int region)
+{
+    assert(region >= 0 && region < num_regions);
+    return (void *)regions[region].start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last byte of a region
+ */
+void *mem_region_hi(int region)
+{
+    assert(region >= 0 && region < num_regions);
+    return (void *)(regions[region].brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of a region in bytes
+ */
+size_t mem_region_size(int region)
+{
+    assert(region >= 0 && region < num_regions);
+    return (size_t)(regions[region].brk - regions[region].start_brk);
+}
+
+/*
+ * mem_region_of - return the number of the region whose extent
+ *    includes addr, or -1 if addr lies in none of them
+ */
+int mem_region_of(void *addr)
+{
+    char *p = (char *)addr;
+    int i;
+
+    for (i = 0; i < num_regions; i++)
+	if (p >= regions[i].start_brk && p < regions[i].brk)
+	    return i;
+    return -1;
+}
+
+/*
+ * mem_num_regions - returns the number of regions, including the
+ *    main heap
+ */
+int mem_num_regions()
+{
+    return num_regions;
+}
+
+/*
+ * mem_guard - make len bytes at addr, which must be page-aligned and 
+ *    lie in the heap, inaccessible (on != 0) or accessible again 
+ *    (on == 0), so that a stray access faults at once. Returns 0, or
+ *    -1 if the protection could not be changed.
+ */
+int mem_guard(void *addr, size_t len, int on)
+{
+    if (mprotect(addr, len, on ? PROT_NONE : PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    if (on)
+	num_guards++;
+    return 0;
+}
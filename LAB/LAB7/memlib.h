@@ -9,3 +9,17 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* 
+ * Independent heap regions, for allocators that manage several 
+ * non-contiguous arenas. Region 0 is the main heap used by mem_sbrk.
+ */
+int mem_region_create(size_t maxsize);
+void *mem_region_sbrk(int region, int incr);
+void *mem_region_lo(int region);
+void *mem_region_hi(int region);
+size_t mem_region_size(int region);
+int mem_region_of(void *addr);
+int mem_num_regions(void);
+
+/* Protect (or unprotect) page-aligned heap memory to catch stray accesses */
+int mem_guard(void *addr, size_t len, int on);
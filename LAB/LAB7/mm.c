@@ -9,6 +9,10 @@
  * Allocated block structure: header(4 bytes), payload, footer(4 bytes) = 8 bytes + payload
  * | header |           payload           | footer |
  *
+ * With mm_profile, the block sizes of the first allocations are counted, and the most frequent ones become size classes.
+ * A freed block of a class size goes on an exact-fit bin of its class instead of being coalesced, and the next request of
+ * that size takes it back in O(1) without splitting anything. The learned classes can be saved to and loaded from a file.
+ *
  * Most of the code including macros and functions are from CS:APP3e textbook and lecture notes.
  */
 #include <assert.h>
@@ -19,6 +23,7 @@
 
 #include "memlib.h"
 #include "mm.h"
+#include "mmsnap.h"
 
 // basic constants
 #define ALIGNMENT 8         // single word (4) or double word (8) alignment
@@ -28,24 +33,57 @@
 #define DSIZE 8             // double word size
 #define MIN_BLOCK_SIZE 16   // minimum block size
 #define CHUNKSIZE (1 << 12) // chunk size of heap extension(4KB)
+#define LISTED 2            // spare header bit of free blocks, set only during mm_snapshot
+#define BINNED 4            // spare header bit of free blocks, set only during mm_snapshot on the blocks in class_bins
+#define REDZONE 2           // spare header bit of allocated blocks: a canary and a guard page follow the payload
+#define CANARY 4            // spare header bit of allocated blocks: a canary follows the payload
+#define CANARY_SIZE 8       // canary size: the payload size, then CANARY_MAGIC xor the block pointer
+#define CANARY_MAGIC 0x5ca1ab1e
+#define CANARY_FILL 0xa5    // fills the slack between the payload and the canary
+#define SNAP_BATCH 256      // block records written at a time by mm_snapshot
+#define NUM_CLASSES 8       // most size classes learned by mm_profile
+#define MAX_CLASS_SIZE 4096 // largest block size that can become a size class
+#define CLASS_MIN_SHARE 32  // a size class must take at least 1 of every CLASS_MIN_SHARE warm-up requests
+// heap metadata references, which an instrumented build (make mdriver-cachesim) feeds to a cache model
+#ifdef MM_CACHESIM
+#include "cachesim.h"
+#define REF(p, n) cachesim_ref((void *)(p), (n))
+#else
+#define REF(p, n) ((void *)(p))
+#endif
 // basic macros
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)           // rounds up to the nearest multiple of ALIGNMENT
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))                       // definition of size_t to align 8 bytes
 #define MAX(x, y) ((x) > (y) ? (x) : (y))                         // max value
 #define PACK(size, alloc) ((size) | (alloc))                      // package size and allocated bit.
-#define GET(p) (*(size_t *)(p))                                   // read 4 bytes from addr p.
-#define PUT(p, val) (*(size_t *)(p) = (val))                      // write 4 bytes val to addr p.
+#define GET(p) (*(size_t *)REF(p, sizeof(size_t)))                // read 4 bytes from addr p.
+#define PUT(p, val) (*(size_t *)REF(p, sizeof(size_t)) = (val))   // write 4 bytes val to addr p.
 #define GET_SIZE(p) (GET(p) & ~0x7)                               // read size from addr p.
 #define GET_ALLOC(p) (GET(p) & 0x1)                               // read allocated bit from addr p.
 #define HDRP(bp) ((void *)(bp)-WSIZE)                             // get header addr from block ptr bp.
 #define FTRP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)      // get footer addr from block ptr bp.
 #define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)))         // get next block ptr from block ptr bp.
 #define PREV_BLKP(bp) ((void *)(bp)-GET_SIZE((HDRP(bp) - WSIZE))) // get prev block ptr from block ptr bp.
-#define NEXT_FREEP(bp) (*(void **)(bp))                           // get next free block ptr from free block ptr bp.
-#define PREV_FREEP(bp) (*(void **)(bp + WSIZE))                   // get prev free block ptr from free block ptr bp.
+#define NEXT_FREEP(bp) (*(void **)REF(bp, sizeof(void *)))        // get next free block ptr from free block ptr bp.
+#define PREV_FREEP(bp) (*(void **)REF(bp + WSIZE, sizeof(void *))) // get prev free block ptr from free block ptr bp.
+#define GUARDP(bp) ((char *)((size_t)FTRP(bp) & ~(mem_pagesize() - 1)) - mem_pagesize()) // get guard page addr of a REDZONE block.
+#define CANARYP(bp, flags) (((flags)&REDZONE ? GUARDP(bp) : (char *)FTRP(bp)) - CANARY_SIZE) // get canary addr from block ptr bp.
 // static variables to indicate heap and free list
 static char *heap_listp = 0; // heap start pointer
 static char *free_listp = 0; // free list start pointer
+// debug mode, see mm_debug
+static int debug_sample = 0;      // check 1 of every debug_sample allocations (0 for none)
+static size_t debug_redzone = 0;  // smallest checked allocation that also gets a guard page (0 for none)
+static unsigned int debug_count = 0; // allocations so far, to pick the sampled ones
+// size classes, see mm_profile
+static size_t classes[NUM_CLASSES];  // block sizes of the size classes in increasing order
+static int num_classes = 0;          // number of size classes (0 until learned or loaded)
+static char *class_bins[NUM_CLASSES]; // freed blocks of each class size, linked by NEXT_FREEP
+static int profile_warmup = 0;       // allocations to profile before choosing the size classes
+static int profile_left = 0;         // allocations still to profile in this heap
+static int profile_fixed = 0;        // set once the classes are learned or loaded, so they outlive mm_init
+static char profile_path[FILENAME_MAX]; // file to save the classes to, or "" for none
+static unsigned int size_hist[MAX_CLASS_SIZE / ALIGNMENT + 1]; // warm-up block sizes, counted in ALIGNMENT steps
 // static functions declaration
 static void *find_fit(size_t size);        // find free block by first fit policy
 static void place(void *bp, size_t asize); // place block by asize
@@ -54,6 +92,12 @@ static void *extend_heap(size_t words);    // extend heap by words * WSIZE
 void pop(void *bp);                        // pop free block from free list
 void push(void *bp);                       // push free block on top of free list
 static void mm_check();                    // check heap consistency
+static void arm(void *bp, size_t size, int flags);       // add a canary (and guard page) to an allocated block
+static void disarm(void *bp, const char *caller);        // check and remove the canary (and guard page) of a block
+static void corrupt(void *bp, const char *caller, const char *what); // report heap corruption and abort
+static int class_of(size_t asize);                       // find the size class of a block size
+static void learn(size_t asize);                         // count a warm-up block size, and choose the classes after the last
+static int flush_bins(void);                             // free every block held in the size class bins
 
 // if below DEBUG is uncommented, print heap consistency in mm_init, mm_malloc, mm_free before return
 // #define DEBUG
@@ -71,11 +115,20 @@ int mm_init(void) {
     PUT(heap_listp + (2 * WSIZE), PACK(0, 0));              // Space for next pointer
     PUT(heap_listp + (3 * WSIZE), PACK(0, 0));              // Space for prev pointer
     PUT(heap_listp + (4 * WSIZE), PACK(MIN_BLOCK_SIZE, 0)); // Free block footer
-    PUT(heap_listp + (5 * WSIZE), PACK(0, 1));              // Epilogue header
+    PUT(heap_listp + (5 * WSIZE), PACK(DSIZE, 1));          // Padding block header
+    PUT(heap_listp + (6 * WSIZE), PACK(DSIZE, 1));          // Padding block footer
+    PUT(heap_listp + (7 * WSIZE), PACK(0, 1));              // Epilogue header, at the end of the heap where extend_heap expects it
     // point free_list to the first header of the first free block
     free_listp = heap_listp + (WSIZE);
     // point heap_listp to the first payload of the first free block
     heap_listp += (2 * WSIZE);
+    // the bins held blocks of the old heap, and unless they are fixed the size classes are learned again
+    memset(class_bins, 0, sizeof(class_bins));
+    if (!profile_fixed) {
+        num_classes = 0;
+        profile_left = profile_warmup;
+        memset(size_hist, 0, sizeof(size_hist));
+    }
 
 #ifdef DEBUG
     printf("in mm_init\n");
@@ -92,10 +145,32 @@ int mm_init(void) {
 void *mm_malloc(size_t size) {
     // align size to 8 bytes
     size_t asize = MAX(ALIGN(size + SIZE_T_SIZE), MIN_BLOCK_SIZE);
+    int debug = 0;
+    // in debug mode, make room for a canary (and a guard page) in 1 of every debug_sample blocks
+    if (debug_sample > 0 && ++debug_count % debug_sample == 0) {
+        debug = (debug_redzone > 0 && size >= debug_redzone) ? REDZONE : CANARY;
+        if (debug == REDZONE)
+            asize = ALIGN(size + SIZE_T_SIZE + CANARY_SIZE) + 2 * mem_pagesize();
+        else
+            asize = ALIGN(size + SIZE_T_SIZE + CANARY_SIZE);
+    }
+    char *bp;
+    int c;
+    // a freed block of a size class fits exactly, without a search or a split
+    if (num_classes > 0 && !debug && (c = class_of(asize)) >= 0 && class_bins[c] != NULL) {
+        bp = class_bins[c];
+        class_bins[c] = NEXT_FREEP(bp);
+        return bp;
+    }
+    if (profile_left > 0)
+        learn(asize);
     // find fit block by first fit policy
-    char *bp = find_fit(asize);
+    bp = find_fit(asize);
 
-    // if fit block is not found, extend heap
+    // if fit block is not found, give the binned blocks back to the free list and try again
+    if (bp == NULL && flush_bins() > 0)
+        bp = find_fit(asize);
+    // if fit block is still not found, extend heap
     if (bp == NULL) {
         // extend size should be more or equal than CHUNKSIZE(4KB)
         size_t extend_size = MAX(asize, CHUNKSIZE);
@@ -107,6 +182,8 @@ void *mm_malloc(size_t size) {
 
     // place size to fit free block
     place(bp, asize);
+    if (debug)
+        arm(bp, size, debug);
 
 #ifdef DEBUG
     printf("in mm_malloc\n");
@@ -250,7 +327,17 @@ void mm_free(void *ptr) {
     if (ptr == NULL) {
         return;
     }
+    // a sampled block must still have its canary
+    if (GET(HDRP(ptr)) & (CANARY | REDZONE))
+        disarm(ptr, "mm_free");
     size_t size = GET_SIZE(HDRP(ptr));
+    int c;
+    // a block of a size class stays allocated on the bin of its class, for the next request of that size
+    if (num_classes > 0 && (c = class_of(size)) >= 0) {
+        NEXT_FREEP(ptr) = class_bins[c];
+        class_bins[c] = ptr;
+        return;
+    }
     // modify header and footer to free block
     PUT(HDRP(ptr), PACK(size, FREE));
     PUT(FTRP(ptr), PACK(size, FREE));
@@ -306,6 +393,9 @@ void *mm_realloc(void *ptr, size_t size) {
         mm_free(ptr);
         return NULL;
     }
+    // a sampled block must still have its canary, and is an ordinary block from now on
+    if (GET(HDRP(ptr)) & (CANARY | REDZONE))
+        disarm(ptr, "mm_realloc");
 
     // otherwise, reallocate ptr to asize comparing with current payload size
     size_t current_size = GET_SIZE(HDRP(ptr));
@@ -366,6 +456,262 @@ void *mm_realloc(void *ptr, size_t size) {
     }
 }
 
+/*
+ * mm_debug - Turn on the debug mode: 1 of every sample allocations gets a canary after its payload, which mm_free and
+ * mm_realloc check, so that an overrun is reported where the block is released instead of crashing coalesce later.
+ * Sampled allocations of at least redzone_min bytes also get an inaccessible guard page after the canary, so that a
+ * larger overrun faults at once. A sample of 0 turns the mode off, and a redzone_min of 0 means no guard pages.
+ * param: sample-check 1 of every sample allocations, redzone_min-smallest allocation that gets a guard page
+ */
+void mm_debug(int sample, size_t redzone_min) {
+    debug_sample = sample;
+    debug_redzone = redzone_min;
+    debug_count = 0;
+}
+
+/*
+ * mm_profile - Learn size classes from the block sizes of the first warmup allocations after each mm_init, or load
+ * them from path if that file exists. Learned classes are saved to path (if not NULL) and kept across mm_init, so
+ * that the rest of the run and later runs use them from the start. A warmup of 0 turns the size classes off.
+ * Return the number of classes loaded from path.
+ * param: warmup-allocations to profile, path-profile file to load or save, or NULL
+ */
+int mm_profile(int warmup, const char *path) {
+    char line[64];
+    unsigned long size;
+    FILE *fp;
+
+    profile_warmup = warmup;
+    profile_left = warmup;
+    profile_fixed = 0;
+    num_classes = 0;
+    memset(class_bins, 0, sizeof(class_bins));
+    memset(size_hist, 0, sizeof(size_hist));
+    profile_path[0] = '\0';
+    if (warmup <= 0 || path == NULL)
+        return 0;
+    snprintf(profile_path, sizeof(profile_path), "%s", path);
+
+    // one block size per line, in increasing order, with # comments
+    if ((fp = fopen(path, "r")) == NULL)
+        return 0;
+    while (num_classes < NUM_CLASSES && fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%lu", &size) != 1)
+            continue;
+        if (size < MIN_BLOCK_SIZE || size > MAX_CLASS_SIZE || size != ALIGN(size) ||
+            (num_classes > 0 && size <= classes[num_classes - 1]))
+            continue;
+        classes[num_classes++] = size;
+    }
+    fclose(fp);
+    if (num_classes > 0) {
+        profile_fixed = 1;
+        profile_left = 0;
+    }
+    return num_classes;
+}
+
+/*
+ * class_of - Find the size class of a block size, and return its index or -1 if it is not a class size
+ * param: asize-block size
+ */
+static int class_of(size_t asize) {
+    int i;
+    for (i = 0; i < num_classes && classes[i] <= asize; i++)
+        if (classes[i] == asize)
+            return i;
+    return -1;
+}
+
+/*
+ * learn - Count a block size of the warm-up, and after the last one choose the most frequent sizes as size classes
+ * param: asize-block size
+ */
+static void learn(size_t asize) {
+    int i, j, best;
+    FILE *fp;
+
+    if (asize <= MAX_CLASS_SIZE)
+        size_hist[asize / ALIGNMENT]++;
+    if (--profile_left > 0)
+        return;
+
+    // pick the NUM_CLASSES most frequent sizes, ignoring those too rare to be worth a bin
+    for (num_classes = 0; num_classes < NUM_CLASSES; num_classes++) {
+        best = 0;
+        for (i = 1; i <= MAX_CLASS_SIZE / ALIGNMENT; i++)
+            if (size_hist[i] > size_hist[best])
+                best = i;
+        if (size_hist[best] == 0 || size_hist[best] * CLASS_MIN_SHARE < (unsigned int)profile_warmup)
+            break;
+        size_hist[best] = 0;
+        // insert in increasing order
+        for (j = num_classes; j > 0 && classes[j - 1] > (size_t)best * ALIGNMENT; j--)
+            classes[j] = classes[j - 1];
+        classes[j] = (size_t)best * ALIGNMENT;
+    }
+    profile_fixed = 1;
+
+    if (profile_path[0] == '\0' || (fp = fopen(profile_path, "w")) == NULL)
+        return;
+    fprintf(fp, "# mm size classes: block sizes in bytes, learned from %d allocations\n", profile_warmup);
+    for (i = 0; i < num_classes; i++)
+        fprintf(fp, "%lu\n", (unsigned long)classes[i]);
+    fclose(fp);
+}
+
+/*
+ * flush_bins - Free every block held in the size class bins, so that they can be coalesced and split again.
+ * Return the number of blocks freed.
+ */
+static int flush_bins(void) {
+    char *bp;
+    int c, n = 0;
+
+    for (c = 0; c < num_classes; c++) {
+        while ((bp = class_bins[c]) != NULL) {
+            class_bins[c] = NEXT_FREEP(bp);
+            PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), FREE));
+            PUT(FTRP(bp), PACK(GET_SIZE(HDRP(bp)), FREE));
+            coalesce(bp);
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * arm - Add a canary to an allocated block, fill the slack before it, and with REDZONE protect the guard page
+ * param: bp-block pointer, size-requested size, flags-CANARY or REDZONE
+ */
+static void arm(void *bp, size_t size, int flags) {
+    // without a guard page, the canary still sits in the (larger) block
+    if (flags == REDZONE && mem_guard(GUARDP(bp), mem_pagesize(), 1) < 0)
+        flags = CANARY;
+    char *canary = CANARYP(bp, flags);
+    memset((char *)bp + size, CANARY_FILL, canary - ((char *)bp + size));
+    PUT(canary, size);
+    PUT(canary + WSIZE, CANARY_MAGIC ^ (size_t)bp);
+    PUT(HDRP(bp), GET(HDRP(bp)) | flags);
+    PUT(FTRP(bp), GET(FTRP(bp)) | flags);
+}
+
+/*
+ * disarm - Check the boundary tags, canary and fill of a sampled block, then remove its guard page and flags
+ * param: bp-block pointer, caller-name of the function that found the block
+ */
+static void disarm(void *bp, const char *caller) {
+    size_t flags = GET(HDRP(bp)) & (CANARY | REDZONE);
+    char *canary, *p;
+    size_t size;
+
+    // the footer is found through the header, so check that first
+    if ((char *)FTRP(bp) > (char *)mem_heap_hi() || GET(HDRP(bp)) != GET(FTRP(bp)))
+        corrupt(bp, caller, "header and footer do not match");
+    canary = CANARYP(bp, flags);
+    size = GET(canary);
+    if (GET(canary + WSIZE) != (CANARY_MAGIC ^ (size_t)bp) || size > (size_t)(canary - (char *)bp))
+        corrupt(bp, caller, "canary overwritten");
+    for (p = (char *)bp + size; p < canary; p++)
+        if (*(unsigned char *)p != CANARY_FILL)
+            corrupt(bp, caller, "write past the end of the payload");
+
+    if ((flags & REDZONE) && mem_guard(GUARDP(bp), mem_pagesize(), 0) < 0)
+        corrupt(bp, caller, "guard page cannot be removed");
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~flags);
+    PUT(FTRP(bp), GET(FTRP(bp)) & ~flags);
+}
+
+/*
+ * corrupt - Report a corrupted block and abort, so that a debugger or core dump shows where it was found
+ * param: bp-block pointer, caller-function that found it, what-kind of corruption
+ */
+static void corrupt(void *bp, const char *caller, const char *what) {
+    fprintf(stderr, "mm: heap corruption in block %p found by %s: %s\n", bp, caller, what);
+    abort();
+}
+
+/*
+ * mm_heapstats - Count the free blocks in the heap, including those held in the size class bins, and find the largest one
+ * param: free_blocks-number of free blocks, largest_free-size of the largest free block
+ */
+void mm_heapstats(size_t *free_blocks, size_t *largest_free) {
+    void *bp;
+    int c;
+    *free_blocks = 0;
+    *largest_free = 0;
+    // walk every block from the one after the sentinel, which is never handed out, to the epilogue header
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            (*free_blocks)++;
+            *largest_free = MAX(*largest_free, GET_SIZE(HDRP(bp)));
+        }
+    }
+    // binned blocks stay marked allocated, but they are free to the program
+    for (c = 0; c < num_classes; c++) {
+        for (bp = class_bins[c]; bp != NULL; bp = NEXT_FREEP(bp)) {
+            (*free_blocks)++;
+            *largest_free = MAX(*largest_free, GET_SIZE(HDRP(bp)));
+        }
+    }
+}
+
+/*
+ * mm_snapshot - Write a binary map of the heap to fd: the offset, size, allocated bit and free list membership of
+ * every block, in the format of mmsnap.h, with the blocks in the size class bins shown as free and listed. Return 0, or
+ * -1 if a write failed.
+ * param: fd-file descriptor to write the snapshot to
+ */
+int mm_snapshot(int fd) {
+    mmsnap_header_t header;
+    mmsnap_block_t records[SNAP_BATCH];
+    size_t steps = mem_heapsize() / MIN_BLOCK_SIZE;
+    char *lo = mem_heap_lo();
+    void *bp;
+    int n = 0, c, result = 0;
+
+    // mark the blocks on the free list, giving up after as many steps as the heap has room for blocks in case the list is corrupt
+    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0 && steps > 0; bp = NEXT_FREEP(bp), steps--)
+        PUT(HDRP(bp), GET(HDRP(bp)) | LISTED);
+    // and show the binned blocks as free blocks on a list until they are written
+    for (c = 0; c < num_classes; c++)
+        for (bp = class_bins[c]; bp != NULL; bp = NEXT_FREEP(bp))
+            PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), FREE) | LISTED | BINNED);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MMSNAP_MAGIC;
+    header.version = MMSNAP_VERSION;
+    header.heap_lo = (uintptr_t)lo;
+    header.heap_size = mem_heapsize();
+    header.page_size = mem_pagesize();
+    // the sentinel block at heap_listp is never handed out, so the map starts after it
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+        header.nblocks++;
+    if (write(fd, &header, sizeof(header)) != sizeof(header))
+        result = -1;
+
+    // write the blocks in batches, and clear the marks on the way
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        records[n].offset = (char *)HDRP(bp) - lo;
+        records[n].size = GET_SIZE(HDRP(bp));
+        if (GET_ALLOC(HDRP(bp))) {
+            records[n].flags = MMSNAP_ALLOC;
+        } else {
+            records[n].flags = (GET(HDRP(bp)) & LISTED) ? MMSNAP_LISTED : 0;
+            if (GET(HDRP(bp)) & BINNED)
+                PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), ALLOCATED));
+            else
+                PUT(HDRP(bp), GET(HDRP(bp)) & ~LISTED);
+        }
+        if (++n == SNAP_BATCH || GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) {
+            if (write(fd, records, n * sizeof(mmsnap_block_t)) != n * sizeof(mmsnap_block_t))
+                result = -1;
+            n = 0;
+        }
+    }
+    return result;
+}
+
 /*
  * mm_check - check heap consistency
  * Check the following shown in the writeup:
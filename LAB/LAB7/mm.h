@@ -4,6 +4,10 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_heapstats(size_t *free_blocks, size_t *largest_free);
+extern int mm_snapshot(int fd);
+extern void mm_debug(int sample, size_t redzone_min);
+extern int mm_profile(int warmup, const char *path);
 
 
 /* 
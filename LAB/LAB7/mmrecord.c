@@ -0,0 +1,503 @@
+/*
+ * mmrecord.c - LD_PRELOAD shim that records the malloc/calloc/realloc/free
+ *     requests of a running program as a Malloc Lab trace file.
+ *
+ * Usage:
+ *     unix> make mmrecord.so
+ *     unix> MMRECORD_FILE=ls.rep LD_PRELOAD=./mmrecord.so ls -l
+ *     unix> ./mdriver -V -f ls.rep
+ *
+ * Every block the program allocates gets the next trace id, which it
+ * keeps across reallocs, so the ids are dense and in allocation order
+ * as mdriver expects. Requests are formatted into a buffer under a
+ * lock and written out when the buffer fills. The header (suggested
+ * heap size, num_ids, num_ops, weight) is written as fixed-width
+ * placeholders when the file is opened and filled in when the program
+ * exits.
+ *
+ * Zero-byte requests and blocks larger than INT_MAX bytes can't be
+ * expressed in a trace, so they (and their frees) are left out, as are
+ * blocks from other allocation functions such as posix_memalign. Blocks
+ * still allocated at exit stay unfreed, so the trace is not balanced.
+ * A forked child stops recording; the parent's trace is unaffected.
+ */
+#define _GNU_SOURCE     /* for RTLD_NEXT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* Default values */
+#define OUTFILE    "mmrecord.rep"  /* trace file if MMRECORD_FILE is unset */
+#define BUFBYTES   (1 << 16)       /* size of the output buffer */
+#define HDRWIDTH   20              /* width of each header line */
+#define HDRLINES   4               /* number of header lines in a trace file */
+#define TABLE_MIN  (1 << 12)       /* initial number of hash table slots */
+#define BOOTBYTES  (1 << 14)       /* for allocations made by dlsym() */
+
+#define EMPTY      ((void *)0)     /* hash table slot was never used */
+#define DELETED    ((void *)1)     /* hash table slot was freed */
+
+/* A live block: maps a payload address to its trace id */
+typedef struct {
+    void *ptr;
+    int id;
+    int size;
+} entry_t;
+
+/* The real allocator functions */
+static void *(*real_malloc)(size_t size);
+static void *(*real_calloc)(size_t nmemb, size_t size);
+static void *(*real_realloc)(void *ptr, size_t size);
+static void (*real_free)(void *ptr);
+
+/* Serves allocations made while the real functions are being looked up */
+static char bootbuf[BOOTBYTES];
+static size_t bootused;
+static int resolving;
+
+/* Recording state, protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int fd = -1;            /* trace file, or -1 if not recording */
+static char buf[BUFBYTES];     /* formatted requests not yet written */
+static size_t buflen;
+static entry_t *table;         /* open-addressed hash table of live blocks */
+static size_t table_slots;     /* always a power of 2 */
+static size_t table_used;      /* live plus deleted slots */
+static int num_ids;            /* next trace id to hand out */
+static long num_ops;           /* requests recorded so far */
+static long live_bytes;        /* payload bytes in live recorded blocks */
+static long max_live_bytes;
+
+/* Set while this thread is inside the recorder, so that allocations
+   made by the recorder itself are not recorded */
+static __thread int busy;
+
+/* function prototypes */
+static void resolve(void);
+static void record_init(void) __attribute__((constructor));
+static void record_fini(void) __attribute__((destructor));
+static void record_prepare(void);
+static void record_parent(void);
+static void record_child(void);
+static void record(char type, int id, int size);
+static void flush_buf(void);
+static void write_header(void);
+static int table_insert(void *ptr, int id, int size);
+static entry_t *table_find(void *ptr);
+static void table_grow(void);
+static void track_alloc(void *ptr, size_t size);
+static void track_free(void *ptr);
+
+/*********************************
+ * The wrapped allocator functions
+ *********************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!real_malloc)
+	resolve();
+    if (!real_malloc) /* called from within dlsym() */
+	return calloc(1, size);
+    p = real_malloc(size);
+    if (p && !busy)
+	track_alloc(p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (!real_calloc) {
+	if (resolving) {
+	    /* dlsym() needs memory before we know where calloc is */
+	    size = (nmemb * size + 15) & ~(size_t)15;
+	    if (bootused + size > BOOTBYTES)
+		return NULL;
+	    p = bootbuf + bootused;
+	    bootused += size;
+	    return p;
+	}
+	resolve();
+    }
+    p = real_calloc(nmemb, size);
+    if (p && !busy && (size == 0 || nmemb <= SIZE_MAX / size))
+	track_alloc(p, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    entry_t *e;
+    size_t left;
+    int id;
+
+    if (!real_realloc)
+	resolve();
+    if (ptr == NULL)
+	return malloc(size);
+    if ((char *)ptr >= bootbuf && (char *)ptr < bootbuf + BOOTBYTES) {
+	/* the old size isn't kept, so copy no further than bootbuf goes */
+	left = bootbuf + BOOTBYTES - (char *)ptr;
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < left ? size : left);
+	return p;
+    }
+    if (busy || fd < 0)
+	return real_realloc(ptr, size);
+
+    /*
+     * Hold the lock across the real call, so no other thread can be
+     * handed (and record) the old block before we have retired it
+     */
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    p = real_realloc(ptr, size);
+    if (p != NULL || size == 0) {
+	e = table_find(ptr);
+	if (e && p && size > 0 && size <= INT_MAX) {
+	    /* realloc keeps the id, but the block may have moved */
+	    id = e->id;
+	    live_bytes += (long)size - e->size;
+	    if (live_bytes > max_live_bytes)
+		max_live_bytes = live_bytes;
+	    record('r', id, (int)size);
+	    e->ptr = DELETED;
+	    table_insert(p, id, (int)size);
+	}
+	else {
+	    if (e) { /* freed by realloc(ptr, 0), or grew too big */
+		live_bytes -= e->size;
+		record('f', e->id, 0);
+		e->ptr = DELETED;
+	    }
+	    if (p && size > 0 && size <= INT_MAX &&
+		table_insert(p, num_ids, (int)size) == 0) {
+		live_bytes += size;
+		if (live_bytes > max_live_bytes)
+		    max_live_bytes = live_bytes;
+		record('a', num_ids++, (int)size);
+	    }
+	}
+    }
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    if ((char *)ptr >= bootbuf && (char *)ptr < bootbuf + BOOTBYTES)
+	return;
+    if (!real_free)
+	resolve();
+    /* Record the free first, in case another thread reuses the block */
+    if (!busy)
+	track_free(ptr);
+    real_free(ptr);
+}
+
+/***********************************************
+ * Setup and teardown of the recording machinery
+ ***********************************************/
+
+/*
+ * resolve - Look up the real allocator functions
+ */
+static void resolve(void)
+{
+    if (resolving)
+	return;
+    resolving = 1;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free) {
+	fprintf(stderr, "mmrecord: could not find the real allocator\n");
+	_exit(1);
+    }
+}
+
+/*
+ * record_init - Open the trace file and reserve space for its header
+ */
+static void record_init(void)
+{
+    char *path = getenv("MMRECORD_FILE");
+
+    busy = 1;
+    resolve();
+    if (path == NULL || *path == '\0')
+	path = OUTFILE;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	fprintf(stderr, "mmrecord: could not open %s\n", path);
+	busy = 0;
+	return;
+    }
+    table_slots = TABLE_MIN;
+    table = mmap(NULL, table_slots * sizeof(entry_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+	fprintf(stderr, "mmrecord: could not allocate the block table\n");
+	close(fd);
+	fd = -1;
+	busy = 0;
+	return;
+    }
+    write_header();
+    pthread_atfork(record_prepare, record_parent, record_child);
+    busy = 0;
+}
+
+/*
+ * record_fini - Write out the buffered requests and the final header
+ */
+static void record_fini(void)
+{
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    if (fd >= 0) {
+	flush_buf();
+	write_header();
+	close(fd);
+	fd = -1;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * record_prepare - Hold the lock across fork, so that no other thread
+ *     is inside the recorder when the child's copy of the state is made
+ */
+static void record_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+/*
+ * record_parent - Let the parent's threads record again after fork
+ */
+static void record_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * record_child - A forked child shares the parent's trace file, so
+ *     it must not write to it. Its copy of the lock is still held
+ *     from record_prepare, so it starts over with a fresh one.
+ */
+static void record_child(void)
+{
+    fd = -1;
+    buflen = 0;
+    pthread_mutex_init(&lock, NULL);
+}
+
+/*
+ * write_header - (Re)write the fixed-width header at the start of the
+ *     file. mdriver reads the header with fscanf, which skips the
+ *     padding.
+ */
+static void write_header(void)
+{
+    char hdr[HDRLINES * HDRWIDTH + 1];
+    long vals[HDRLINES];
+    int i;
+
+    vals[0] = max_live_bytes;
+    vals[1] = num_ids;
+    vals[2] = num_ops;
+    vals[3] = 1;
+    for (i = 0; i < HDRLINES; i++)
+	snprintf(hdr + i * HDRWIDTH, HDRWIDTH + 1, "%-*ld\n",
+		 HDRWIDTH - 1, vals[i]);
+    if (pwrite(fd, hdr, HDRLINES * HDRWIDTH, 0) != HDRLINES * HDRWIDTH)
+	fprintf(stderr, "mmrecord: error writing trace header\n");
+    if (lseek(fd, 0, SEEK_END) < 0)
+	fprintf(stderr, "mmrecord: error seeking in trace file\n");
+}
+
+/*******************************************************
+ * Recording requests. All of these run with lock held.
+ *******************************************************/
+
+/*
+ * track_alloc - Give a new block the next id and record its allocation
+ */
+static void track_alloc(void *ptr, size_t size)
+{
+    if (size == 0 || size > INT_MAX)
+	return;
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    if (fd >= 0 && table_insert(ptr, num_ids, (int)size) == 0) {
+	live_bytes += size;
+	if (live_bytes > max_live_bytes)
+	    max_live_bytes = live_bytes;
+	record('a', num_ids++, (int)size);
+    }
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+}
+
+/*
+ * track_free - Record the free of a block we have given an id
+ */
+static void track_free(void *ptr)
+{
+    entry_t *e;
+
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    if (fd >= 0 && (e = table_find(ptr)) != NULL) {
+	live_bytes -= e->size;
+	record('f', e->id, 0);
+	e->ptr = DELETED;
+    }
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+}
+
+/*
+ * record - Append one request line to the output buffer
+ */
+static void record(char type, int id, int size)
+{
+    char line[32];
+    char digits[12];
+    int n = 0, d;
+    unsigned v;
+
+    line[n++] = type;
+    line[n++] = ' ';
+    for (v = id, d = 0; d == 0 || v > 0; v /= 10)
+	digits[d++] = '0' + v % 10;
+    while (d > 0)
+	line[n++] = digits[--d];
+    if (type != 'f') {
+	line[n++] = ' ';
+	for (v = size, d = 0; d == 0 || v > 0; v /= 10)
+	    digits[d++] = '0' + v % 10;
+	while (d > 0)
+	    line[n++] = digits[--d];
+    }
+    line[n++] = '\n';
+
+    if (buflen + n > BUFBYTES)
+	flush_buf();
+    memcpy(buf + buflen, line, n);
+    buflen += n;
+    num_ops++;
+}
+
+/*
+ * flush_buf - Write the buffered requests to the trace file
+ */
+static void flush_buf(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < buflen) {
+	if ((n = write(fd, buf + done, buflen - done)) <= 0) {
+	    fprintf(stderr, "mmrecord: error writing trace, recording stopped\n");
+	    close(fd);
+	    fd = -1;
+	    break;
+	}
+	done += n;
+    }
+    buflen = 0;
+}
+
+/*
+ * table_insert - Add a live block with the given id. Returns 0, or -1
+ *     if the table is full and could not grow.
+ */
+static int table_insert(void *ptr, int id, int size)
+{
+    size_t i;
+
+    if (2 * (table_used + 1) > table_slots)
+	table_grow();
+    if (2 * (table_used + 1) > table_slots)
+	return -1;
+    i = ((size_t)ptr >> 4) & (table_slots - 1);
+    while (table[i].ptr != EMPTY && table[i].ptr != DELETED)
+	i = (i + 1) & (table_slots - 1);
+    if (table[i].ptr == EMPTY)
+	table_used++;
+    table[i].ptr = ptr;
+    table[i].id = id;
+    table[i].size = size;
+    return 0;
+}
+
+/*
+ * table_find - Return the entry of a live block, or NULL if we are
+ *     not tracking it
+ */
+static entry_t *table_find(void *ptr)
+{
+    size_t i;
+
+    if (table == NULL)
+	return NULL;
+    i = ((size_t)ptr >> 4) & (table_slots - 1);
+    while (table[i].ptr != EMPTY) {
+	if (table[i].ptr == ptr)
+	    return &table[i];
+	i = (i + 1) & (table_slots - 1);
+    }
+    return NULL;
+}
+
+/*
+ * table_grow - Rehash the live blocks into a table twice as large,
+ *     which also drops the deleted slots. The table lives in mmap'd
+ *     memory so it never calls back into the allocator.
+ */
+static void table_grow(void)
+{
+    entry_t *old = table;
+    size_t old_slots = table_slots;
+    size_t i, j, live = 0;
+    entry_t *new;
+
+    for (i = 0; i < old_slots; i++)
+	if (old[i].ptr != EMPTY && old[i].ptr != DELETED)
+	    live++;
+    table_slots = (4 * live > old_slots) ? 2 * old_slots : old_slots;
+    new = mmap(NULL, table_slots * sizeof(entry_t), PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new == MAP_FAILED) {
+	table_slots = old_slots;
+	return;
+    }
+    for (i = 0; i < old_slots; i++) {
+	if (old[i].ptr == EMPTY || old[i].ptr == DELETED)
+	    continue;
+	j = ((size_t)old[i].ptr >> 4) & (table_slots - 1);
+	while (new[j].ptr != EMPTY)
+	    j = (j + 1) & (table_slots - 1);
+	new[j] = old[i];
+    }
+    munmap(old, old_slots * sizeof(entry_t));
+    table = new;
+    table_used = live;
+}
@@ -0,0 +1,375 @@
+/*
+ * mmsnap.c - Offline analyzer for the heap snapshots written by
+ *     mm_snapshot() (see mdriver -D)
+ *
+ * Reports how the heap is split between allocated and free blocks,
+ * a histogram of the free block sizes, the external fragmentation
+ * (the fraction of free bytes outside the largest free block, which
+ * a request for more than that block cannot use), the longest run of
+ * adjacent free blocks, and free blocks missing from the free list.
+ *
+ * It also draws how full each page of the heap is, as text and, with
+ * -p, as a PNG image: one cell per page, red for full pages, green
+ * for empty ones, white past the end of the heap.
+ *
+ * Usage: mmsnap [-h] [-w <pages>] [-p <file.png>] <snapshot>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mmsnap.h"
+
+/* Default values */
+#define ROW_PAGES  64   /* pages per row of the occupancy map */
+#define CELL       8    /* pixels per side of a page in the PNG */
+#define BUCKETS    32   /* power-of-two buckets in the free size histogram */
+
+static void print_map(double *occ, long npages, int width);
+static void write_png(char *filename, double *occ, long npages, int width);
+static void png_chunk(FILE *fp, char *type, unsigned char *data,
+		      unsigned long len);
+static unsigned long crc32(unsigned long crc, unsigned char *buf,
+			   unsigned long len);
+static void put32(unsigned char *p, unsigned long val);
+static void usage(void);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    char c;
+    int width = ROW_PAGES;
+    char *pngname = NULL;
+    FILE *fp;
+    mmsnap_header_t hdr;
+    mmsnap_block_t *blocks, *b;
+    unsigned long i, nalloc = 0, nfree = 0, unlisted = 0, run_blocks = 0;
+    unsigned long long alloc_bytes = 0, free_bytes = 0, largest = 0;
+    unsigned long long run = 0, best_run = 0, best_off = 0, best_blocks = 0;
+    unsigned long long hist_blocks[BUCKETS], hist_bytes[BUCKETS];
+    unsigned long long lo, hi, first_page, addr;
+    long npages, page;
+    double *occ;
+    int k;
+
+    while ((c = getopt(argc, argv, "hw:p:")) != EOF) {
+	switch (c) {
+	case 'w':
+	    if ((width = atoi(optarg)) <= 0)
+		app_error("the map width must be positive");
+	    break;
+	case 'p':
+	    pngname = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+
+    /* Read the snapshot */
+    if ((fp = fopen(argv[optind], "rb")) == NULL)
+	app_error("could not open the snapshot");
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != MMSNAP_MAGIC)
+	app_error("not a heap snapshot");
+    if (hdr.version != MMSNAP_VERSION)
+	app_error("unsupported snapshot version");
+    if ((blocks = calloc(hdr.nblocks + 1, sizeof(mmsnap_block_t))) == NULL)
+	app_error("out of memory");
+    if (fread(blocks, sizeof(mmsnap_block_t), hdr.nblocks, fp) != hdr.nblocks)
+	app_error("snapshot is truncated");
+    fclose(fp);
+
+    /* Totals, free size histogram, and the longest free run */
+    memset(hist_blocks, 0, sizeof(hist_blocks));
+    memset(hist_bytes, 0, sizeof(hist_bytes));
+    for (i = 0; i < hdr.nblocks; i++) {
+	b = &blocks[i];
+	if (b->flags & MMSNAP_ALLOC) {
+	    nalloc++;
+	    alloc_bytes += b->size;
+	    run = 0;
+	    run_blocks = 0;
+	    continue;
+	}
+	nfree++;
+	free_bytes += b->size;
+	if (b->size > largest)
+	    largest = b->size;
+	if (!(b->flags & MMSNAP_LISTED))
+	    unlisted++;
+	for (k = 0; k < BUCKETS - 1 && (2ULL << k) <= b->size; k++)
+	    ;
+	hist_blocks[k]++;
+	hist_bytes[k] += b->size;
+
+	if (run > 0 && blocks[i-1].offset + blocks[i-1].size != b->offset)
+	    run = run_blocks = 0;
+	run += b->size;
+	run_blocks++;
+	if (run > best_run) {
+	    best_run = run;
+	    best_blocks = run_blocks;
+	    best_off = b->offset + b->size - run;
+	}
+    }
+
+    printf("Heap: %llu bytes at 0x%llx, %lu blocks, page size %u\n",
+	   (unsigned long long)hdr.heap_size,
+	   (unsigned long long)hdr.heap_lo, (unsigned long)hdr.nblocks,
+	   hdr.page_size);
+    printf("Allocated: %lu blocks, %llu bytes (%.1f%% of the heap)\n",
+	   nalloc, alloc_bytes,
+	   hdr.heap_size ? 100.0 * alloc_bytes / hdr.heap_size : 0.0);
+    printf("Free: %lu blocks, %llu bytes (%.1f%% of the heap)\n",
+	   nfree, free_bytes,
+	   hdr.heap_size ? 100.0 * free_bytes / hdr.heap_size : 0.0);
+    if (unlisted > 0)
+	printf("Free blocks missing from the free list: %lu\n", unlisted);
+    printf("Largest free block: %llu bytes\n", largest);
+    printf("External fragmentation: %.3f\n",
+	   free_bytes ? 1.0 - (double)largest / free_bytes : 0.0);
+    if (best_run > 0)
+	printf("Longest free run: %llu bytes at offset %llu (%llu block%s)\n",
+	       best_run, best_off, best_blocks, best_blocks == 1 ? "" : "s");
+
+    if (nfree > 0) {
+	printf("\nFree block sizes:\n%22s%10s%14s\n", "size", "blocks",
+	       "bytes");
+	for (k = 0; k < BUCKETS; k++) {
+	    if (hist_blocks[k] == 0)
+		continue;
+	    if (k == BUCKETS - 1)
+		printf("%10llu%12s", 1ULL << k, "and up");
+	    else
+		printf("%10llu - %9llu", 1ULL << k, (2ULL << k) - 1);
+	    printf("%10llu%14llu\n", hist_blocks[k], hist_bytes[k]);
+	}
+    }
+
+    /* Fraction of each page covered by allocated blocks */
+    if (hdr.page_size == 0)
+	app_error("snapshot has no page size");
+    lo = hdr.heap_lo;
+    hi = hdr.heap_lo + hdr.heap_size;
+    first_page = lo / hdr.page_size;
+    npages = (hi + hdr.page_size - 1) / hdr.page_size - first_page;
+    if ((occ = calloc(npages + 1, sizeof(double))) == NULL)
+	app_error("out of memory");
+    for (i = 0; i < hdr.nblocks; i++) {
+	b = &blocks[i];
+	if (!(b->flags & MMSNAP_ALLOC))
+	    continue;
+	for (addr = lo + b->offset; addr < lo + b->offset + b->size; ) {
+	    unsigned long long end = (addr / hdr.page_size + 1) * hdr.page_size;
+	    if (end > lo + b->offset + b->size)
+		end = lo + b->offset + b->size;
+	    page = addr / hdr.page_size - first_page;
+	    occ[page] += (double)(end - addr) / hdr.page_size;
+	    addr = end;
+	}
+    }
+
+    print_map(occ, npages, width);
+    if (pngname != NULL)
+	write_png(pngname, occ, npages, width);
+
+    free(occ);
+    free(blocks);
+    exit(0);
+}
+
+/*
+ * print_map - Print one character per page, width pages per row,
+ *     showing how much of the page allocated blocks cover
+ */
+static void print_map(double *occ, long npages, int width)
+{
+    long page;
+
+    printf("\nPage occupancy (' ' empty, '.' <25%%, ':' <50%%, "
+	   "'+' <75%%, '*' <100%%, '#' full):\n");
+    for (page = 0; page < npages; page++) {
+	if (page % width == 0)
+	    printf("%6ld |", page);
+	if (occ[page] <= 0)
+	    putchar(' ');
+	else if (occ[page] < 0.25)
+	    putchar('.');
+	else if (occ[page] < 0.5)
+	    putchar(':');
+	else if (occ[page] < 0.75)
+	    putchar('+');
+	else if (occ[page] < 0.999)
+	    putchar('*');
+	else
+	    putchar('#');
+	if (page % width == width - 1 || page == npages - 1)
+	    printf("|\n");
+    }
+}
+
+/*
+ * write_png - Draw the occupancy map as an RGB PNG image, CELL pixels
+ *     per page. The image data is stored uncompressed, so no zlib is
+ *     needed.
+ */
+static void write_png(char *filename, double *occ, long npages, int width)
+{
+    static unsigned char sig[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    unsigned long w = (unsigned long)width * CELL;
+    unsigned long h = (npages + width - 1) / width * CELL;
+    unsigned long rowlen = 1 + 3 * w, rawlen = rowlen * h;
+    unsigned long nstored = (rawlen + 65534) / 65535;
+    unsigned long zlen = 2 + 5 * nstored + rawlen + 4;
+    unsigned char ihdr[13], *raw, *z, *p;
+    unsigned long x, y, off, len, a = 1, b = 0;
+    FILE *fp;
+
+    if ((raw = malloc(rawlen)) == NULL || (z = malloc(zlen)) == NULL)
+	app_error("out of memory");
+
+    /* Filter type 0 rows of RGB pixels */
+    for (y = 0; y < h; y++) {
+	p = raw + y * rowlen;
+	*p++ = 0;
+	for (x = 0; x < w; x++) {
+	    long page = (y / CELL) * width + x / CELL;
+	    int border = (x % CELL == CELL - 1) || (y % CELL == CELL - 1);
+	    if (page >= npages) {
+		p[0] = p[1] = p[2] = 255;
+	    }
+	    else if (border) {
+		p[0] = p[1] = p[2] = 160;
+	    }
+	    else {
+		double f = occ[page] > 1 ? 1 : occ[page];
+		p[0] = (unsigned char)(40 + 215 * f);
+		p[1] = (unsigned char)(200 - 160 * f);
+		p[2] = 60;
+	    }
+	    p += 3;
+	}
+    }
+
+    /* zlib stream of stored deflate blocks */
+    p = z;
+    *p++ = 0x78;
+    *p++ = 0x01;
+    for (off = 0; off < rawlen; off += len) {
+	len = rawlen - off > 65535 ? 65535 : rawlen - off;
+	*p++ = (off + len == rawlen);   /* BFINAL, BTYPE 00 */
+	*p++ = len & 0xff;
+	*p++ = len >> 8;
+	*p++ = ~len & 0xff;
+	*p++ = (~len >> 8) & 0xff;
+	memcpy(p, raw + off, len);
+	p += len;
+    }
+    for (off = 0; off < rawlen; off++) {
+	a = (a + raw[off]) % 65521;
+	b = (b + a) % 65521;
+    }
+    put32(p, (b << 16) | a);
+
+    put32(ihdr, w);
+    put32(ihdr + 4, h);
+    ihdr[8] = 8;    /* bit depth */
+    ihdr[9] = 2;    /* truecolor */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    if ((fp = fopen(filename, "wb")) == NULL)
+	app_error("could not open the PNG file");
+    fwrite(sig, 1, sizeof(sig), fp);
+    png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(fp, "IDAT", z, zlen);
+    png_chunk(fp, "IEND", NULL, 0);
+    if (fclose(fp) != 0)
+	app_error("could not write the PNG file");
+    free(raw);
+    free(z);
+}
+
+/*
+ * png_chunk - Write one PNG chunk: length, type, data and CRC
+ */
+static void png_chunk(FILE *fp, char *type, unsigned char *data,
+		      unsigned long len)
+{
+    unsigned char buf[4];
+    unsigned long crc;
+
+    put32(buf, len);
+    fwrite(buf, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    if (len > 0)
+	fwrite(data, 1, len, fp);
+    crc = crc32(0xffffffffUL, (unsigned char *)type, 4);
+    crc = crc32(crc, data, len) ^ 0xffffffffUL;
+    put32(buf, crc);
+    fwrite(buf, 1, 4, fp);
+}
+
+/*
+ * crc32 - Update a CRC-32 (as used by PNG) with len bytes of buf
+ */
+static unsigned long crc32(unsigned long crc, unsigned char *buf,
+			   unsigned long len)
+{
+    static unsigned long table[256];
+    static int have_table = 0;
+    unsigned long c, n;
+    int k;
+
+    if (!have_table) {
+	for (n = 0; n < 256; n++) {
+	    c = n;
+	    for (k = 0; k < 8; k++)
+		c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+	    table[n] = c;
+	}
+	have_table = 1;
+    }
+    for (n = 0; n < len; n++)
+	crc = table[(crc ^ buf[n]) & 0xff] ^ (crc >> 8);
+    return crc & 0xffffffffUL;
+}
+
+/*
+ * put32 - Store val at p as a big-endian 32-bit integer
+ */
+static void put32(unsigned char *p, unsigned long val)
+{
+    p[0] = (val >> 24) & 0xff;
+    p[1] = (val >> 16) & 0xff;
+    p[2] = (val >> 8) & 0xff;
+    p[3] = val & 0xff;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmsnap [-h] [-w <pages>] [-p <file.png>] <snapshot>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h             Print this message.\n");
+    fprintf(stderr, "\t-p <file.png>  Also draw the page occupancy map as a PNG image.\n");
+    fprintf(stderr, "\t-w <pages>     Pages per row of the map (default %d).\n", ROW_PAGES);
+}
+
+/*
+ * app_error - Report an error and terminate
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "mmsnap: %s\n", msg);
+    exit(1);
+}
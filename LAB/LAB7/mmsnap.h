@@ -0,0 +1,37 @@
+/*
+ * mmsnap.h - Format of the heap snapshots written by mm_snapshot() and
+ *     read by the mmsnap analyzer
+ *
+ * A snapshot is a header followed by one record per block, in address
+ * order, from the first block after the prologue to the epilogue. All
+ * fields have fixed widths, so a snapshot taken by the 32-bit driver
+ * can be read by a 64-bit analyzer on the same (little-endian) host.
+ */
+#ifndef __MMSNAP_H_
+#define __MMSNAP_H_
+
+#include <stdint.h>
+
+#define MMSNAP_MAGIC   0x50534d4d  /* "MMSP" */
+#define MMSNAP_VERSION 1
+
+/* Block flags */
+#define MMSNAP_ALLOC   0x1   /* block is allocated */
+#define MMSNAP_LISTED  0x2   /* block is on a free list */
+
+typedef struct {
+    uint32_t magic;       /* MMSNAP_MAGIC */
+    uint32_t version;     /* MMSNAP_VERSION */
+    uint64_t heap_lo;     /* address of the first heap byte */
+    uint64_t heap_size;   /* heap size in bytes */
+    uint32_t page_size;   /* page size of the host */
+    uint32_t nblocks;     /* number of block records that follow */
+} mmsnap_header_t;
+
+typedef struct {
+    uint32_t offset;      /* offset of the block (its header) in the heap */
+    uint32_t size;        /* block size, including header and footer */
+    uint32_t flags;       /* MMSNAP_ALLOC, MMSNAP_LISTED */
+} mmsnap_block_t;
+
+#endif /* __MMSNAP_H_ */
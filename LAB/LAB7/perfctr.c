@@ -0,0 +1,162 @@
+/*
+ * perfctr.c - Read the hardware performance counters around a measured
+ *     run using the Linux perf_event_open system call.
+ *
+ * Each counter is opened on its own rather than as a group, so that a
+ * machine (or virtual machine) that lacks one kind of event still gets
+ * the others. When the kernel has to multiplex the counters, the values
+ * are scaled by the fraction of time each one was actually counting.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* How to configure each counter */
+static struct {
+    char *name;
+    unsigned type;
+    unsigned long long config;
+} events[PERF_NCOUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1D-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+static int fds[PERF_NCOUNTERS] = {-1, -1, -1, -1, -1, -1};
+
+/*
+ * perf_open - Open as many of the counters as the system allows
+ */
+int perf_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] >= 0) {
+	    n++;
+	    continue;
+	}
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * perf_close - Close the counters
+ */
+void perf_close(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	fds[i] = -1;
+    }
+}
+
+/*
+ * perf_start - Zero and start the open counters
+ */
+void perf_start(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+}
+
+/*
+ * perf_stop - Stop the counters and read them, scaling for multiplexing
+ */
+void perf_stop(perf_counts_t *counts)
+{
+    unsigned long long v[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	counts->valid[i] = 0;
+	counts->val[i] = 0;
+	if (fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+	    continue;
+	counts->valid[i] = 1;
+	counts->val[i] = (double)v[0] * ((double)v[1] / (double)v[2]);
+    }
+}
+
+/*
+ * perf_name - Return the short name of counter i
+ */
+char *perf_name(int i)
+{
+    return events[i].name;
+}
+
+#else
+
+/*******************************************************************
+ * perf events are Linux-only. Elsewhere no counters are available, 
+ * and the timing layer falls back to timing alone.
+ ******************************************************************/
+
+static char *names[PERF_NCOUNTERS] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "br-miss", "dTLB-miss"
+};
+
+int perf_open(void)
+{
+    return 0;
+}
+
+void perf_close(void)
+{
+}
+
+void perf_start(void)
+{
+}
+
+void perf_stop(perf_counts_t *counts)
+{
+    memset(counts, 0, sizeof(perf_counts_t));
+}
+
+char *perf_name(int i)
+{
+    return names[i];
+}
+#endif
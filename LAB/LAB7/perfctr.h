@@ -0,0 +1,42 @@
+/*
+ * perfctr.h - prototypes for the routines in perfctr.c that read the
+ *     hardware performance counters through perf_event_open (Linux only)
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The counters we try to open, in the order they are reported */
+#define PERF_CYCLES        0
+#define PERF_INSTRUCTIONS  1
+#define PERF_L1D_MISSES    2
+#define PERF_LLC_MISSES    3
+#define PERF_BRANCH_MISSES 4
+#define PERF_DTLB_MISSES   5
+#define PERF_NCOUNTERS     6
+
+/* Counter values; a counter that could not be opened has valid[i] == 0 */
+typedef struct {
+    int valid[PERF_NCOUNTERS];
+    double val[PERF_NCOUNTERS];
+} perf_counts_t;
+
+/* 
+ * Open the counters for the calling process (user mode only). Returns
+ * the number of counters that could be opened, 0 if perf events are 
+ * not available on this system.
+ */
+int perf_open(void);
+
+/* Close the counters */
+void perf_close(void);
+
+/* Zero and start the open counters */
+void perf_start(void);
+
+/* Stop the counters and read them into *counts */
+void perf_stop(perf_counts_t *counts);
+
+/* Short name of counter i, for table headers */
+char *perf_name(int i);
+
+#endif /* __PERFCTR_H_ */
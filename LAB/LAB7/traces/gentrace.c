@@ -0,0 +1,389 @@
+/*
+ * gentrace.c - Fast generator for large synthetic Malloc Lab traces
+ *
+ * Emits a balanced trace file in the format read by mdriver (see the
+ * README in this directory). Unlike the gen_XXX.pl scripts, it is meant
+ * for traces with millions of requests, and everything about the trace
+ * is configurable:
+ *
+ *   - block sizes are drawn from a fixed, uniform, bimodal or power-law
+ *     distribution,
+ *   - each block lives for a number of allocation steps drawn from a
+ *     fixed, uniform, exponential or power-law distribution, and
+ *   - between allocations, a random live block may be reallocated to a
+ *     size that grows by a constant factor or increment.
+ *
+ * The same seed and options always produce the same trace.
+ *
+ * Usage: gentrace [-h] [-n <allocs>] [-s <seed>] [-d <sizes>]
+ *                 [-l <lifetimes>] [-r <prob>] [-g <growth>]
+ *                 [-m <maxsize>] [-o <file>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/* Default values */
+#define NUM_ALLOCS  1000000       /* number of allocate requests */
+#define SEED        1             /* random seed */
+#define SIZES       "powerlaw:1.5:16:4096"
+#define LIFETIMES   "exp:1000"
+#define GROWTH      "mul:1.5"
+#define MAX_SIZE    (1 << 20)     /* largest block a realloc grows to */
+#define HEAP_SLACK  100           /* added to the suggested heap size */
+
+/* A distribution parsed from a "kind:arg:arg..." command line string */
+typedef struct {
+    enum {FIXED, UNIFORM, BIMODAL, EXPONENTIAL, POWERLAW} kind;
+    double a, b, c;
+} dist_t;
+
+/* How a reallocated block grows */
+typedef struct {
+    enum {MULTIPLY, ADD} kind;
+    double amount;
+} growth_t;
+
+/* A min-heap entry: block id dies after allocation step death */
+typedef struct {
+    long death;
+    int id;
+} event_t;
+
+/* Random number generator state (xorshift64*) */
+static unsigned long long rng_state;
+
+/* Min-heap of pending frees, ordered by death */
+static event_t *heap;
+static long heap_count, heap_max;
+
+/* Live ids, kept dense so a random live block can be picked in O(1) */
+static int *live;            /* live[0..num_live-1] are the live ids */
+static long *live_pos;       /* live_pos[id] is the index of id in live */
+static int *sizes;           /* sizes[id] is the current size of block id */
+static long num_live;
+
+/* function prototypes */
+static void parse_dist(char *spec, dist_t *dist);
+static void parse_growth(char *spec, growth_t *growth);
+static double rng_uniform(void);
+static double sample(dist_t *dist);
+static void heap_push(long death, int id);
+static event_t heap_pop(void);
+static void usage(void);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    char c;
+    long num_allocs = NUM_ALLOCS;
+    unsigned long long seed = SEED;
+    double realloc_prob = 0.0;
+    int max_size = MAX_SIZE;
+    char *outname = NULL;
+    dist_t size_dist, life_dist;
+    growth_t growth;
+
+    FILE *body, *out;
+    long step, num_ops = 0;
+    long live_bytes = 0, max_live_bytes = 0;
+    int id, size, newsize;
+    size_t n;
+    char buf[1 << 16];
+    event_t ev;
+
+    parse_dist(SIZES, &size_dist);
+    parse_dist(LIFETIMES, &life_dist);
+    parse_growth(GROWTH, &growth);
+
+    while ((c = getopt(argc, argv, "hn:s:d:l:r:g:m:o:")) != EOF) {
+	switch (c) {
+	case 'n': /* Number of allocate requests */
+	    num_allocs = atol(optarg);
+	    break;
+	case 's': /* Random seed */
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'd': /* Block size distribution */
+	    parse_dist(optarg, &size_dist);
+	    break;
+	case 'l': /* Block lifetime distribution */
+	    parse_dist(optarg, &life_dist);
+	    break;
+	case 'r': /* Probability of a realloc after each allocation */
+	    realloc_prob = atof(optarg);
+	    break;
+	case 'g': /* How reallocated blocks grow */
+	    parse_growth(optarg, &growth);
+	    break;
+	case 'm': /* Largest size a realloc may grow a block to */
+	    max_size = atoi(optarg);
+	    break;
+	case 'o': /* Output file */
+	    outname = optarg;
+	    break;
+	case 'h': /* Print this message */
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (num_allocs < 1 || num_allocs > 0x7fffffff || max_size < 1)
+	app_error("Bad number of allocations or maximum size");
+
+    rng_state = seed ? seed : SEED;
+    heap_max = 1024;
+    if ((heap = malloc(heap_max * sizeof(event_t))) == NULL ||
+	(live = malloc(num_allocs * sizeof(int))) == NULL ||
+	(live_pos = malloc(num_allocs * sizeof(long))) == NULL ||
+	(sizes = malloc(num_allocs * sizeof(int))) == NULL)
+	app_error("Out of memory");
+
+    /*
+     * The header needs the number of requests, so write the requests
+     * to a temporary file first and copy them after the header
+     */
+    if ((body = tmpfile()) == NULL)
+	app_error("Could not create temporary file");
+
+    for (step = 0; step < num_allocs; step++) {
+	/* Free every block whose lifetime has run out */
+	while (heap_count > 0 && heap[0].death <= step) {
+	    ev = heap_pop();
+	    live[live_pos[ev.id]] = live[--num_live];
+	    live_pos[live[num_live]] = live_pos[ev.id];
+	    live_bytes -= sizes[ev.id];
+	    fprintf(body, "f %d\n", ev.id);
+	    num_ops++;
+	}
+
+	/* Allocate a new block */
+	id = (int)step;
+	size = (int)sample(&size_dist);
+	if (size < 1)
+	    size = 1;
+	sizes[id] = size;
+	live_pos[id] = num_live;
+	live[num_live++] = id;
+	live_bytes += size;
+	heap_push(step + 1 + (long)sample(&life_dist), id);
+	fprintf(body, "a %d %d\n", id, size);
+	num_ops++;
+
+	/* Maybe grow a random live block */
+	if (realloc_prob > 0 && rng_uniform() < realloc_prob) {
+	    id = live[(long)(rng_uniform() * num_live)];
+	    if (growth.kind == MULTIPLY)
+		newsize = (int)(sizes[id] * growth.amount);
+	    else
+		newsize = (int)(sizes[id] + growth.amount);
+	    if (newsize > max_size)
+		newsize = max_size;
+	    if (newsize < 1)
+		newsize = 1;
+	    live_bytes += newsize - sizes[id];
+	    sizes[id] = newsize;
+	    fprintf(body, "r %d %d\n", id, newsize);
+	    num_ops++;
+	}
+
+	if (live_bytes > max_live_bytes)
+	    max_live_bytes = live_bytes;
+    }
+
+    /* Free the blocks that are still live so the trace is balanced */
+    while (heap_count > 0) {
+	ev = heap_pop();
+	fprintf(body, "f %d\n", ev.id);
+	num_ops++;
+    }
+
+    /* Write the header followed by the requests */
+    if (outname == NULL)
+	out = stdout;
+    else if ((out = fopen(outname, "w")) == NULL)
+	app_error("Could not open output file");
+    fprintf(out, "%ld\n%ld\n%ld\n%d\n",
+	    max_live_bytes + HEAP_SLACK, num_allocs, num_ops, 1);
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body)) > 0)
+	fwrite(buf, 1, n, out);
+    fclose(body);
+    if (fclose(out) != 0)
+	app_error("Error writing output file");
+
+    free(heap);
+    free(live);
+    free(live_pos);
+    free(sizes);
+    exit(0);
+}
+
+/*
+ * parse_dist - Parse a distribution spec. The supported specs are
+ *     fixed:N, uniform:MIN:MAX, bimodal:A:B:P (A with probability P,
+ *     else B), exp:MEAN and powerlaw:ALPHA:MIN:MAX.
+ */
+static void parse_dist(char *spec, dist_t *dist)
+{
+    char kind[32];
+    int n;
+
+    dist->a = dist->b = dist->c = 0;
+    n = sscanf(spec, "%31[a-z]:%lf:%lf:%lf", kind,
+	       &dist->a, &dist->b, &dist->c);
+    if (n == 2 && !strcmp(kind, "fixed"))
+	dist->kind = FIXED;
+    else if (n == 3 && !strcmp(kind, "uniform") && dist->a <= dist->b)
+	dist->kind = UNIFORM;
+    else if (n == 4 && !strcmp(kind, "bimodal"))
+	dist->kind = BIMODAL;
+    else if (n == 2 && !strcmp(kind, "exp") && dist->a > 0)
+	dist->kind = EXPONENTIAL;
+    else if (n == 4 && !strcmp(kind, "powerlaw") &&
+	     dist->b > 0 && dist->b <= dist->c)
+	dist->kind = POWERLAW;
+    else {
+	fprintf(stderr, "Bad distribution: %s\n", spec);
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_growth - Parse a realloc growth spec, mul:FACTOR or add:BYTES
+ */
+static void parse_growth(char *spec, growth_t *growth)
+{
+    char kind[32];
+
+    if (sscanf(spec, "%31[a-z]:%lf", kind, &growth->amount) == 2 &&
+	!strcmp(kind, "mul"))
+	growth->kind = MULTIPLY;
+    else if (sscanf(spec, "%31[a-z]:%lf", kind, &growth->amount) == 2 &&
+	     !strcmp(kind, "add"))
+	growth->kind = ADD;
+    else {
+	fprintf(stderr, "Bad growth: %s\n", spec);
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * rng_uniform - Return a uniform random number in [0, 1)
+ */
+static double rng_uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * sample - Draw a value from a distribution
+ */
+static double sample(dist_t *dist)
+{
+    double u = rng_uniform();
+    double e;
+
+    switch (dist->kind) {
+    case FIXED:
+	return dist->a;
+    case UNIFORM:
+	return dist->a + u * (dist->b - dist->a + 1);
+    case BIMODAL:
+	return (u < dist->c) ? dist->a : dist->b;
+    case EXPONENTIAL:
+	return -dist->a * log(1.0 - u);
+    case POWERLAW:
+	/* Inverse CDF of a Pareto distribution truncated to [b, c] */
+	if (dist->a == 1.0)
+	    return dist->b * pow(dist->c / dist->b, u);
+	e = 1.0 - dist->a;
+	return pow(pow(dist->b, e) + u * (pow(dist->c, e) - pow(dist->b, e)),
+		   1.0 / e);
+    }
+    return 0;
+}
+
+/*
+ * heap_push - Schedule block id to be freed after step death
+ */
+static void heap_push(long death, int id)
+{
+    long i = heap_count++;
+    event_t tmp;
+
+    if (heap_count > heap_max) {
+	heap_max *= 2;
+	if ((heap = realloc(heap, heap_max * sizeof(event_t))) == NULL)
+	    app_error("Out of memory");
+    }
+    heap[i].death = death;
+    heap[i].id = id;
+    while (i > 0 && heap[(i-1)/2].death > heap[i].death) {
+	tmp = heap[(i-1)/2];
+	heap[(i-1)/2] = heap[i];
+	heap[i] = tmp;
+	i = (i-1)/2;
+    }
+}
+
+/*
+ * heap_pop - Remove and return the block that dies first
+ */
+static event_t heap_pop(void)
+{
+    event_t top = heap[0], tmp;
+    long i = 0, child;
+
+    heap[0] = heap[--heap_count];
+    while ((child = 2*i + 1) < heap_count) {
+	if (child + 1 < heap_count && heap[child+1].death < heap[child].death)
+	    child++;
+	if (heap[i].death <= heap[child].death)
+	    break;
+	tmp = heap[i];
+	heap[i] = heap[child];
+	heap[child] = tmp;
+	i = child;
+    }
+    return top;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-h] [-n <allocs>] [-s <seed>] [-d <sizes>] [-l <lifetimes>]\n");
+    fprintf(stderr, "                [-r <prob>] [-g <growth>] [-m <maxsize>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d <sizes>     Block size distribution (default %s).\n", SIZES);
+    fprintf(stderr, "\t-g <growth>    Realloc growth, mul:FACTOR or add:BYTES (default %s).\n", GROWTH);
+    fprintf(stderr, "\t-h             Print this message.\n");
+    fprintf(stderr, "\t-l <lifetimes> Block lifetime distribution, in allocations (default %s).\n", LIFETIMES);
+    fprintf(stderr, "\t-m <maxsize>   Largest size a realloc may grow a block to (default %d).\n", MAX_SIZE);
+    fprintf(stderr, "\t-n <allocs>    Number of allocate requests (default %d).\n", NUM_ALLOCS);
+    fprintf(stderr, "\t-o <file>      Write the trace to <file> instead of stdout.\n");
+    fprintf(stderr, "\t-r <prob>      Probability of a realloc after each allocation (default 0).\n");
+    fprintf(stderr, "\t-s <seed>      Random seed (default %d).\n", SEED);
+    fprintf(stderr, "Distributions\n");
+    fprintf(stderr, "\tfixed:N  uniform:MIN:MAX  bimodal:A:B:P  exp:MEAN  powerlaw:ALPHA:MIN:MAX\n");
+}
+
+/*
+ * app_error - Report an error and terminate
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}